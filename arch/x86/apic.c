@@ -23,6 +23,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <apic.h>
+#include <cmdline.h>
 #include <console.h>
 #include <cpu.h>
 #include <ktf.h>
@@ -32,6 +33,7 @@
 #include <processor.h>
 #include <time.h>
 #include <traps.h>
+#include <tsc.h>
 
 static apic_mode_t apic_mode = APIC_MODE_UNKNOWN;
 
@@ -161,7 +163,7 @@ void init_apic(unsigned int cpu_id, apic_mode_t mode) {
      * X2APIC uses MSRs for accesses, so no mapping needed.
      */
     if (apic_mode == APIC_MODE_XAPIC)
-        vmap_kern_4k(apic_get_base(apic_base), apic_base.base, L1_PROT_NOCACHE_GLOB);
+        vmap_kern_4k_cached(apic_get_base(apic_base), apic_base.base, L1_PROT_GLOB, UC);
 
     spiv.reg = apic_read(APIC_SPIV);
     spiv.vector = APIC_SPI_VECTOR;
@@ -169,6 +171,12 @@ void init_apic(unsigned int cpu_id, apic_mode_t mode) {
     apic_write(APIC_SPIV, spiv.reg);
 }
 
+#define CPUID_FEATURE_TSC_DEADLINE (_U32(1) << 24)
+
+static inline bool cpu_has_tsc_deadline(void) {
+    return !!(cpuid_ecx(0x1) & CPUID_FEATURE_TSC_DEADLINE);
+}
+
 #define CAL_SLEEP_TIME 20
 #define CAL_ITERATIONS 10
 void init_apic_timer(void) {
@@ -202,14 +210,49 @@ void init_apic_timer(void) {
 
     interrupts_restore(flags);
 
-    /* Interrupt every min_ticks ticks */
+    PERCPU_SET(apic_ticks_per_ms, min_ticks);
+    PERCPU_SET(apic_timer_enabled, true);
+
     apic_write(APIC_TMR_DCR, APIC_TIMER_DIVIDE_BY_16);
+    timer.vector = APIC_TIMER_IRQ_OFFSET;
+
+    /* Tickless: the timer is only armed for the next pending timer expiry */
+    if (opt_tickless) {
+        /* Cached, as CPUID traps under a hypervisor and the timer path is hot */
+        PERCPU_SET(apic_tsc_deadline, cpu_has_tsc_deadline());
+        timer.timer_mode = PERCPU_GET(apic_tsc_deadline) ? APIC_LVT_TIMER_TSC_DEADLINE
+                                                         : APIC_LVT_TIMER_ONE_SHOT;
+        apic_write(APIC_LVT_TIMER, timer.reg);
+        apic_timer_set_deadline(0);
+        return;
+    }
+
+    /* Interrupt every min_ticks ticks */
     apic_write(APIC_TMR_ICR, min_ticks);
 
     /* Switch to periodic mode */
-    timer.vector = APIC_TIMER_IRQ_OFFSET;
     timer.timer_mode = APIC_LVT_TIMER_PERIODIC;
     apic_write(APIC_LVT_TIMER, timer.reg);
+}
 
-    PERCPU_SET(apic_timer_enabled, true);
+/* Arm the one-shot local APIC timer for a TSC deadline. Zero disarms the timer */
+void apic_timer_set_deadline(uint64_t deadline) {
+    uint64_t now, count;
+
+    if (PERCPU_GET(apic_tsc_deadline)) {
+        wrmsr(MSR_TSC_DEADLINE, deadline);
+        return;
+    }
+
+    if (!deadline) {
+        apic_write(APIC_TMR_ICR, 0);
+        return;
+    }
+
+    /* TSC cycles per ms are the TSC frequency in kHz */
+    now = rdtsc();
+    count = deadline > now ? (deadline - now) * PERCPU_GET(apic_ticks_per_ms) /
+                                 max(get_tsc_khz(), _U64(1))
+                           : 0;
+    apic_write(APIC_TMR_ICR, max(min(count, (uint64_t) _U32(-1)), _U64(1)));
 }
@@ -35,6 +35,7 @@
 
 void __asm_offset_header(void) {
     OFFSETOF(usermode_private, percpu_t, usermode_private);
+    OFFSETOF(percpu_irq_count, percpu_t, irq_count);
 
     OFFSETOF(cpu_exc_vector, cpu_exc_t, vector);
     OFFSETOF(cpu_exc_error_code, cpu_exc_t, error_code);
@@ -76,6 +77,8 @@ void __asm_offset_header(void) {
     EMIT_DEFINE(kb_port1_irq, KB_PORT1_IRQ);
     EMIT_DEFINE(kb_port2_irq, KB_PORT2_IRQ);
     EMIT_DEFINE(apic_timer_irq, APIC_TIMER_IRQ);
+    EMIT_DEFINE(wakeup_irq, WAKEUP_IRQ);
+    EMIT_DEFINE(quiet_irq, QUIET_IRQ);
 #ifdef KTF_ACPICA
     EMIT_DEFINE(acpi_sci_irq, ACPI_SCI_IRQ);
 #endif
@@ -112,3 +112,59 @@ bool cpu_vendor_string(char *cpu_str) {
 
     return true;
 }
+
+static inline unsigned int count_order(unsigned int count) {
+    unsigned int order = 0;
+
+    while ((1U << order) < count)
+        order++;
+
+    return order;
+}
+
+static uint32_t get_topology_leaf(void) {
+    uint32_t max_leaf = cpuid_eax(0x0);
+
+    if (max_leaf >= CPUID_TOPOLOGY_V2_LEAF && cpuid_ebx(CPUID_TOPOLOGY_V2_LEAF))
+        return CPUID_TOPOLOGY_V2_LEAF;
+
+    if (max_leaf >= CPUID_TOPOLOGY_LEAF && cpuid_ebx(CPUID_TOPOLOGY_LEAF))
+        return CPUID_TOPOLOGY_LEAF;
+
+    return 0;
+}
+
+/* Decode the APIC ID layout from leaf 0x1F (or 0xB). Any levels between a core and
+ * its package (modules, dies) end up as part of the core ID.
+ * Without the extended leaves, leaf 0x1 only gives the number of logical
+ * processors per package and SMT siblings cannot be told apart from cores.
+ */
+bool cpuid_get_topology(cpuid_topology_t *topo) {
+    uint32_t leaf = get_topology_leaf();
+    uint32_t eax, ebx, ecx, edx;
+
+    memset(topo, 0, sizeof(*topo));
+
+    if (!leaf) {
+        ebx = cpuid_ebx(0x1);
+        if (cpuid_edx(0x1) & (1U << 28)) /* HTT */
+            topo->package_shift = count_order((ebx >> 16) & 0xff);
+        return false;
+    }
+
+    for (uint32_t level = 0;; level++) {
+        ebx = edx = 0;
+        ecx = level;
+        cpuid(leaf, &eax, &ebx, &ecx, &edx);
+
+        unsigned int type = (ecx >> 8) & 0xff;
+        if (type == CPUID_TOPOLOGY_LEVEL_INVALID)
+            break;
+
+        if (type == CPUID_TOPOLOGY_LEVEL_SMT)
+            topo->smt_shift = eax & 0x1f;
+        topo->package_shift = eax & 0x1f;
+    }
+
+    return true;
+}
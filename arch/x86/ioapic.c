@@ -29,6 +29,7 @@
 #include <list.h>
 #include <mm/slab.h>
 #include <pagetable.h>
+#include <rwlock.h>
 #include <string.h>
 
 #define IOAPIC_SYSTEM_ISA_BUS_NAME "ISA"
@@ -41,6 +42,8 @@ static ioapic_t ioapics[MAX_IOAPICS];
 static unsigned nr_ioapics;
 
 static list_head_t bus_list = LIST_INIT(bus_list);
+/* Protects bus_list and the IRQ override lists of its buses */
+static rwlock_t bus_list_lock = RWLOCK_INIT;
 
 static int __get_system_bus_name(uint8_t bus_name[IOAPIC_SYSTEM_BUS_NAME_SIZE],
                                  const char *name, size_t namelen) {
@@ -100,17 +103,20 @@ bus_t *add_system_bus(uint8_t id, const char *name, size_t namelen) {
         return NULL;
     }
 
+    write_lock(&bus_list_lock);
     bus = get_system_bus_by_id(id);
     if (bus) {
         if (memcmp(bus->name, bus_name, sizeof(bus->name))) {
             printk("System Bus ID(%u) name mismatch (actual: %6s, expected: %6s)\n", id,
                    bus->name, bus_name);
-            return NULL;
+            bus = NULL;
         }
-        return bus;
+        goto unlock;
     }
 
     bus = __add_system_bus(id, bus_name);
+unlock:
+    write_unlock(&bus_list_lock);
     return bus;
 }
 
@@ -118,16 +124,22 @@ int add_system_bus_irq_override(uint8_t bus_id, irq_override_t *override) {
     irq_override_t *new_override;
     bus_t *bus;
 
-    bus = get_system_bus_by_id(bus_id);
-    if (!bus)
-        return -ENODEV;
-
     new_override = kzalloc(sizeof(*new_override));
     if (!new_override)
         return -ENOMEM;
-
     memcpy(new_override, override, sizeof(*new_override));
-    list_add_tail(&new_override->list, &bus->irq_overrides);
+
+    write_lock(&bus_list_lock);
+    bus = get_system_bus_by_id(bus_id);
+    if (bus)
+        list_add_tail(&new_override->list, &bus->irq_overrides);
+    write_unlock(&bus_list_lock);
+
+    if (!bus) {
+        kfree(new_override);
+        return -ENODEV;
+    }
+
     return 0;
 }
 
@@ -147,25 +159,29 @@ static irq_override_t *__get_irq_override(bus_t *bus, uint8_t irq_type,
 }
 
 irq_override_t *get_system_isa_bus_irq(uint8_t irq_type, uint32_t irq_src) {
+    irq_override_t *override;
     bus_t *bus;
 
+    read_lock(&bus_list_lock);
     bus = get_system_bus_by_name(IOAPIC_SYSTEM_ISA_BUS_NAME,
                                  strlen(IOAPIC_SYSTEM_ISA_BUS_NAME));
-    if (!bus)
-        return NULL;
+    override = __get_irq_override(bus, irq_type, irq_src);
+    read_unlock(&bus_list_lock);
 
-    return __get_irq_override(bus, irq_type, irq_src);
+    return override;
 }
 
 irq_override_t *get_system_pci_bus_irq(uint8_t irq_type, uint32_t irq_src) {
+    irq_override_t *override;
     bus_t *bus;
 
+    read_lock(&bus_list_lock);
     bus = get_system_bus_by_name(IOAPIC_SYSTEM_PCI_BUS_NAME,
                                  strlen(IOAPIC_SYSTEM_PCI_BUS_NAME));
-    if (!bus)
-        return NULL;
+    override = __get_irq_override(bus, irq_type, irq_src);
+    read_unlock(&bus_list_lock);
 
-    return __get_irq_override(bus, irq_type, irq_src);
+    return override;
 }
 
 void __text_init init_ioapic(void) {
@@ -219,8 +235,8 @@ ioapic_t *add_ioapic(uint8_t id, uint8_t version, bool enabled, uint64_t base_ad
     ioapic->gsi_base = gsi_base;
 
     ioapic->virt_address =
-        vmap_kern_4k(paddr_to_virt(ioapic->base_address),
-                     paddr_to_mfn(ioapic->base_address), L1_PROT_NOCACHE);
+        vmap_kern_4k_cached(paddr_to_virt(ioapic->base_address),
+                            paddr_to_mfn(ioapic->base_address), L1_PROT, UC);
     BUG_ON(!ioapic->virt_address);
 
     return ioapic;
@@ -260,6 +276,58 @@ void set_ioapic_irq_mask(ioapic_t *ioapic, unsigned irq, ioapic_int_mask_t mask)
     set_ioapic_redirtbl_entry(ioapic, irq, &entry);
 }
 
+static inline bool is_gsi_in(uint32_t gsi, const uint32_t *gsis, unsigned nr_gsis) {
+    for (unsigned i = 0; i < nr_gsis; i++) {
+        if (gsis[i] == gsi)
+            return true;
+    }
+
+    return false;
+}
+
+/* Mask all unmasked lines of all IOAPICs, except for the given GSIs. Returns the
+ * number of lines masked.
+ */
+unsigned ioapic_quiesce(const uint32_t *keep_gsis, unsigned nr_keep) {
+    unsigned nr_masked = 0;
+
+    for (unsigned i = 0; i < nr_ioapics; i++) {
+        ioapic_t *ioapic = &ioapics[i];
+
+        memset(ioapic->quiesced, 0, sizeof(ioapic->quiesced));
+        for (unsigned irq = 0; irq < ioapic->nr_entries; irq++) {
+            ioapic_redirtbl_entry_t entry;
+
+            if (is_gsi_in(ioapic->gsi_base + irq, keep_gsis, nr_keep))
+                continue;
+
+            get_ioapic_redirtbl_entry(ioapic, irq, &entry);
+            if (entry.int_mask == IOAPIC_INT_MASK)
+                continue;
+
+            entry.int_mask = IOAPIC_INT_MASK;
+            set_ioapic_redirtbl_entry(ioapic, irq, &entry);
+            ioapic->quiesced[irq / 64] |= _U64(1) << (irq % 64);
+            nr_masked++;
+        }
+    }
+
+    return nr_masked;
+}
+
+/* Unmask the lines masked by ioapic_quiesce() */
+void ioapic_unquiesce(void) {
+    for (unsigned i = 0; i < nr_ioapics; i++) {
+        ioapic_t *ioapic = &ioapics[i];
+
+        for (unsigned irq = 0; irq < ioapic->nr_entries; irq++) {
+            if (ioapic->quiesced[irq / 64] & (_U64(1) << (irq % 64)))
+                set_ioapic_irq_mask(ioapic, irq, IOAPIC_INT_UNMASK);
+        }
+        memset(ioapic->quiesced, 0, sizeof(ioapic->quiesced));
+    }
+}
+
 static inline bool is_ioapic_irq(ioapic_t *ioapic, uint32_t irq_src) {
     return irq_src >= ioapic->gsi_base && irq_src < ioapic->gsi_base + ioapic->nr_entries;
 }
@@ -124,6 +124,8 @@ static void dump_pagetable(mfn_t table, int level) {
 }
 
 void dump_pagetables(cr3_t *cr3_ptr) {
+    unsigned long flags;
+
     ASSERT(cr3_ptr);
     if (mfn_invalid(cr3_ptr->mfn)) {
         warning("CR3: 0x%lx is invalid", cr3.paddr);
@@ -131,15 +133,16 @@ void dump_pagetables(cr3_t *cr3_ptr) {
     }
 
     printk("Page Tables: CR3 paddr: 0x%lx\n", cr3.paddr);
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     dump_pagetable(cr3_ptr->mfn, PT_LEVELS);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 }
 
 static void dump_pagetable_va(cr3_t *cr3_ptr, void *va) {
     paddr_t tab_paddr;
     pgentry_t *tab;
     int level = PT_LEVELS;
+    unsigned long flags;
 
     ASSERT(cr3_ptr);
     if (mfn_invalid(cr3_ptr->mfn)) {
@@ -147,7 +150,7 @@ static void dump_pagetable_va(cr3_t *cr3_ptr, void *va) {
         return;
     }
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
 
     tab = tmp_map_mfn(cr3_ptr->mfn);
 #if defined(__x86_64__)
@@ -180,7 +183,7 @@ static void dump_pagetable_va(cr3_t *cr3_ptr, void *va) {
     dump_pte(l1e, tab_paddr, level--, l1_table_index(va));
 
 unlock:
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 }
 
 void dump_kern_pagetable_va(void *va) {
@@ -372,11 +375,13 @@ void *vmap(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned int order,
            unsigned long l4_flags,
 #endif
            unsigned long l3_flags, unsigned long l2_flags, unsigned long l1_flags) {
+    unsigned long flags;
+
     dprintk("%s: va: 0x%p mfn: 0x%lx (order: %u)\n", __func__, va, mfn, order);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     va = _vmap(cr3_ptr, va, mfn, order, l4_flags, l3_flags, l2_flags, l1_flags);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return va;
 }
@@ -384,12 +389,13 @@ void *vmap(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned int order,
 void *vmap_1g(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned long l3_flags,
               bool propagate_user) {
     unsigned long _va = _ul(va) & PAGE_ORDER_TO_MASK(PAGE_ORDER_1G);
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p mfn: 0x%lx\n", __func__, va, mfn);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     va = _vmap_1g(cr3_ptr, _ptr(_va), mfn, l3_flags, propagate_user);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return va;
 }
@@ -397,12 +403,13 @@ void *vmap_1g(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned long l3_flags,
 void *vmap_2m(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned long l2_flags,
               bool propagate_user) {
     unsigned long _va = _ul(va) & PAGE_ORDER_TO_MASK(PAGE_ORDER_2M);
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p mfn: 0x%lx\n", __func__, va, mfn);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     va = _vmap_2m(cr3_ptr, _ptr(_va), mfn, l2_flags, propagate_user);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return va;
 }
@@ -410,12 +417,13 @@ void *vmap_2m(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned long l2_flags,
 void *vmap_4k(cr3_t *cr3_ptr, void *va, mfn_t mfn, unsigned long l1_flags,
               bool propagate_user) {
     unsigned long _va = _ul(va) & PAGE_ORDER_TO_MASK(PAGE_ORDER_4K);
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p mfn: 0x%lx\n", __func__, va, mfn);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     va = _vmap_4k(cr3_ptr, _ptr(_va), mfn, l1_flags, propagate_user);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return va;
 }
@@ -503,21 +511,23 @@ done:
 
 int vunmap_kern(void *va, mfn_t *mfn, unsigned int *order) {
     int err;
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p (cr3: 0x%p)\n", __func__, va, &cr3);
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     err = _vunmap(&cr3, va, mfn, order);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
     return err;
 }
 
 int vunmap_user(void *va, mfn_t *mfn, unsigned int *order) {
     int err;
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p (cr3: 0x%p)\n", __func__, va, &cr3);
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     err = _vunmap(&user_cr3, va, mfn, order);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
     return err;
 }
 
@@ -579,24 +589,26 @@ done:
 
 int get_kern_va_mfn_order(void *va, mfn_t *mfn, unsigned int *order) {
     int err;
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p (cr3: 0x%p)\n", __func__, va, &cr3);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     err = get_va_mfn_order(&cr3, va, mfn, order);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return err;
 }
 
 int get_user_va_mfn_order(void *va, mfn_t *mfn, unsigned int *order) {
     int err;
+    unsigned long flags;
 
     dprintk("%s: va: 0x%p (cr3: 0x%p)\n", __func__, va, &user_cr3);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     err = get_va_mfn_order(&user_cr3, va, mfn, order);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return err;
 }
@@ -605,10 +617,11 @@ static frame_t *find_va_frame(const cr3_t *cr3_ptr, const void *va) {
     unsigned int order;
     mfn_t mfn;
     int err;
+    unsigned long flags;
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     err = get_va_mfn_order(cr3_ptr, va, &mfn, &order);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 
     return err ? NULL : find_mfn_frame(mfn, order);
 }
@@ -642,6 +655,10 @@ static inline int _vmap_range(mfn_t mfn, unsigned int order, unsigned long flags
                               vmap_flags_t vmap_flags) {
     const int err = -EFAULT;
 
+    /* Large page entries carry the PAT bit at a different position (bit 12) */
+    if (order != PAGE_ORDER_4K && (flags & _PAGE_PAT))
+        flags = (flags & ~_PAGE_PAT) | _PAGE_PSE_PAT;
+
     /* NOTE: It might make sense to unmap partial completed mappings in case of an
      *       error. For now, we just return an error and let the caller handle it.
      */
@@ -702,6 +719,7 @@ int vmap_range(paddr_t paddr, size_t size, unsigned long flags, vmap_flags_t vma
     paddr_t end = cur + size;
     mfn_t mfn;
     int err;
+    unsigned long irqflags;
 
     dprintk("%s: paddr: 0x%lx, size: %lx\n", __func__, paddr, size);
 
@@ -713,7 +731,7 @@ int vmap_range(paddr_t paddr, size_t size, unsigned long flags, vmap_flags_t vma
     if (end <= cur)
         return -EINVAL;
 
-    spin_lock(&vmap_lock);
+    irqflags = spin_lock_irqsave(&vmap_lock);
     while (cur < end) {
         mfn = paddr_to_mfn(cur);
 
@@ -749,10 +767,17 @@ int vmap_range(paddr_t paddr, size_t size, unsigned long flags, vmap_flags_t vma
     err = 0;
 
 unlock:
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, irqflags);
     return err;
 }
 
+int vmap_range_cached(paddr_t paddr, size_t size, unsigned long flags,
+                      pat_memory_type_t type, vmap_flags_t vmap_flags) {
+    flags = (flags & ~_PAGE_CACHE_MASK) | pat_cache_flags(type);
+
+    return vmap_range(paddr, size, flags, vmap_flags);
+}
+
 static inline int _vunmap_range_chunk(cr3_t *cr3_ptr, void *va, unsigned int *order) {
     mfn_t mfn = MFN_INVALID;
     int err;
@@ -784,6 +809,7 @@ int vunmap_range(paddr_t paddr, size_t size, vmap_flags_t vmap_flags) {
     paddr_t start = paddr;
     paddr_t end = start + size;
     int err;
+    unsigned long flags;
 
     dprintk("%s: paddr: 0x%lx, size: %lx\n", __func__, paddr, size);
 
@@ -795,7 +821,7 @@ int vunmap_range(paddr_t paddr, size_t size, vmap_flags_t vmap_flags) {
     if (end <= start)
         return -EINVAL;
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
 
     if (vmap_flags & VMAP_KERNEL) {
         err = _vunmap_range(&cr3, paddr_to_virt_kern(start), paddr_to_virt_kern(end));
@@ -849,7 +875,7 @@ int vunmap_range(paddr_t paddr, size_t size, vmap_flags_t vmap_flags) {
 
     err = 0;
 unlock:
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
     return err;
 }
 
@@ -886,6 +912,8 @@ static void map_pagetable(cr3_t *cr3_ptr, mfn_t table, int level) {
 }
 
 void map_pagetables(cr3_t *to_cr3, cr3_t *from_cr3) {
+    unsigned long flags;
+
     ASSERT(to_cr3);
     if (mfn_invalid(to_cr3->mfn)) {
         warning("Target CR3: 0x%lx is invalid", to_cr3->paddr);
@@ -902,10 +930,10 @@ void map_pagetables(cr3_t *to_cr3, cr3_t *from_cr3) {
     dprintk("Mapping all page tables of CR3: 0x%lx to CR3: 0x%lx\n", from_cr3->paddr,
             to_cr3->paddr);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     /* Assume PML4 is not mapped */
     map_pagetable(to_cr3, from_cr3->mfn, PT_LEVELS);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 }
 
 static void unmap_pagetable(cr3_t *cr3_ptr, mfn_t table, int level) {
@@ -928,6 +956,8 @@ static void unmap_pagetable(cr3_t *cr3_ptr, mfn_t table, int level) {
 }
 
 void unmap_pagetables(cr3_t *from_cr3, cr3_t *of_cr3) {
+    unsigned long flags;
+
     ASSERT(from_cr3);
     if (mfn_invalid(from_cr3->mfn)) {
         warning("Target CR3: 0x%lx is invalid", from_cr3->paddr);
@@ -944,15 +974,16 @@ void unmap_pagetables(cr3_t *from_cr3, cr3_t *of_cr3) {
     dprintk("Unmapping all page tables of CR3: 0x%lx from CR3: 0x%lx\n", of_cr3->paddr,
             from_cr3->paddr);
 
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     /* Assume PML4 is mapped */
     unmap_pagetable(from_cr3, of_cr3->mfn, PT_LEVELS);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
 }
 
 int map_pagetables_va(cr3_t *cr3_ptr, void *va) {
     pgentry_t *tab;
     int err = -EINVAL;
+    unsigned long flags;
 
     ASSERT(cr3_ptr);
     if (mfn_invalid(cr3_ptr->mfn)) {
@@ -966,7 +997,7 @@ int map_pagetables_va(cr3_t *cr3_ptr, void *va) {
     }
 
     err = -EFAULT;
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     tab = _vmap(cr3_ptr, mfn_to_virt_kern(cr3_ptr->mfn), cr3_ptr->mfn, PAGE_ORDER_4K,
                 L4_PROT, L3_PROT, L2_PROT, L1_PROT);
     if (!tab)
@@ -1016,7 +1047,7 @@ int map_pagetables_va(cr3_t *cr3_ptr, void *va) {
 done:
     err = 0;
 unlock:
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
     return err;
 }
 
@@ -1025,6 +1056,7 @@ int unmap_pagetables_va(cr3_t *cr3_ptr, void *va) {
     pgentry_t *tab, *tables[PT_LEVELS] = {NULL};
     int level = 0;
     int err = -EINVAL;
+    unsigned long flags;
 
     ASSERT(cr3_ptr);
     if (mfn_invalid(cr3_ptr->mfn)) {
@@ -1038,7 +1070,7 @@ int unmap_pagetables_va(cr3_t *cr3_ptr, void *va) {
     }
 
     err = -EFAULT;
-    spin_lock(&vmap_lock);
+    flags = spin_lock_irqsave(&vmap_lock);
     tab = _vmap(cr3_ptr, mfn_to_virt_kern(cr3_ptr->mfn), cr3_ptr->mfn, PAGE_ORDER_4K,
                 L4_PROT, L3_PROT, L2_PROT, L1_PROT);
     if (!tab)
@@ -1092,7 +1124,7 @@ done:
 cleanup:
     for (unsigned i = 0; i < ARRAY_SIZE(tables) && tables[i]; i++)
         _vunmap(cr3_ptr, tables[i], NULL, NULL);
-    spin_unlock(&vmap_lock);
+    spin_unlock_irqrestore(&vmap_lock, flags);
     return err;
 }
 
@@ -23,21 +23,78 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <console.h>
+#include <lib.h>
 #include <pagetable.h>
 
-#define PAT_FIELD_BIT_POS(field) (8 * field)
+#define PAT_FIELD_BIT_POS(field) (8 * (field))
+#define PAT_FIELD_MASK           _U64(0x7)
+
+/* Power-on PAT layout: WB, WT, UC-, UC, WB, WT, UC-, UC */
+#define PAT_DEFAULT _U64(0x0007040600070406)
+
+#define CPUID_FEATURE_PAT (_U32(1) << 16)
+
+static bool pat_enabled = false;
+static uint64_t pat_value = PAT_DEFAULT;
 
 void pat_set_type(pat_field_t field, pat_memory_type_t type) {
-    /* TODO: cpuid: check this feature is implemented */
-    unsigned long value = rdmsr(MSR_PAT);
-    value = value & ~(0x7 << PAT_FIELD_BIT_POS(field));
-    value = value | (type << PAT_FIELD_BIT_POS(field));
+    uint64_t value = rdmsr(MSR_PAT);
+
+    value &= ~(PAT_FIELD_MASK << PAT_FIELD_BIT_POS(field));
+    value |= ((uint64_t) type & PAT_FIELD_MASK) << PAT_FIELD_BIT_POS(field);
     wrmsr(MSR_PAT, value);
 }
 
 pat_memory_type_t pat_get_type(pat_field_t field) {
-    /* TODO: cpuid: check this feature is implemented */
-    unsigned long value = rdmsr(MSR_PAT);
-    value = value >> PAT_FIELD_BIT_POS(field);
-    return value & 0x7;
-}
\ No newline at end of file
+    uint64_t value = rdmsr(MSR_PAT);
+
+    return (value >> PAT_FIELD_BIT_POS(field)) & PAT_FIELD_MASK;
+}
+
+static inline bool cpu_has_pat(void) {
+    return !!(cpuid_edx(0x1) & CPUID_FEATURE_PAT);
+}
+
+/* Keep PA0-PA3 at their power-on defaults, so that plain PWT/PCD mappings
+ * retain their usual meaning, and replace the redundant PA5 (WT) with WC.
+ * This has to be done on every CPU before it touches any WC mapping.
+ */
+void init_pat(void) {
+    if (!cpu_has_pat()) {
+        warning("PAT not supported. Cache type mappings limited to PWT/PCD");
+        return;
+    }
+
+    pat_set_type(PA5, WC);
+    pat_value = rdmsr(MSR_PAT);
+    pat_enabled = true;
+    flush_tlb();
+}
+
+static inline unsigned long pat_field_to_pte_flags(pat_field_t field) {
+    unsigned long flags = PT_NO_FLAGS;
+
+    if (field & 0x1)
+        flags |= _PAGE_PWT;
+    if (field & 0x2)
+        flags |= _PAGE_PCD;
+    if (field & 0x4)
+        flags |= _PAGE_PAT;
+
+    return flags;
+}
+
+/* Return 4K PTE flags (PWT, PCD and PAT bits) selecting the requested memory type.
+ * Unavailable memory types fall back to strong uncacheable.
+ */
+unsigned long pat_cache_flags(pat_memory_type_t type) {
+    pat_field_t last = pat_enabled ? PA7 : PA3;
+
+    for (pat_field_t field = PA0; field <= last; field++) {
+        if (((pat_value >> PAT_FIELD_BIT_POS(field)) & PAT_FIELD_MASK) == type)
+            return pat_field_to_pte_flags(field);
+    }
+
+    return _PAGE_PWT | _PAGE_PCD;
+}
@@ -45,6 +45,8 @@ extern void asm_interrupt_handler_keyboard(void);
 extern void asm_interrupt_handler_timer(void);
 extern void asm_interrupt_handler_dummy(void);
 extern void asm_interrupt_handler_apic_timer(void);
+extern void asm_interrupt_handler_wakeup(void);
+extern void asm_interrupt_handler_quiet(void);
 
 extern void terminate_user_task(void);
 
@@ -171,6 +173,10 @@ void init_traps(const cpu_t *cpu) {
                   _ul(asm_interrupt_handler_keyboard), GATE_DPL0, GATE_PRESENT, 0);
     set_intr_gate(&percpu->idt[APIC_TIMER_IRQ], __KERN_CS,
                   _ul(asm_interrupt_handler_apic_timer), GATE_DPL0, GATE_PRESENT, 0);
+    set_intr_gate(&percpu->idt[WAKEUP_IRQ], __KERN_CS,
+                  _ul(asm_interrupt_handler_wakeup), GATE_DPL0, GATE_PRESENT, 0);
+    set_intr_gate(&percpu->idt[QUIET_IRQ], __KERN_CS,
+                  _ul(asm_interrupt_handler_quiet), GATE_DPL0, GATE_PRESENT, 0);
     set_intr_gate(&percpu->idt[APIC_SPI_VECTOR], __KERN_CS,
                   _ul(asm_interrupt_handler_dummy), GATE_DPL0, GATE_PRESENT, 0);
 
@@ -0,0 +1,200 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <console.h>
+#include <cpuid.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <setup.h>
+#include <time.h>
+#include <tsc.h>
+
+#define TSC_CAL_TICKS 50 /* ms of global timer */
+
+static uint64_t tsc_khz;
+static uint64_t tsc_mult; /* ns per cycle, 32.32 fixed point */
+static bool tsc_synchronized = true;
+
+/* Cache line shared by the BSP and the AP being synchronized */
+static struct {
+    volatile uint64_t target_tsc;
+    volatile unsigned int seq;
+} __aligned(64) tsc_sync;
+
+static uint64_t tsc_khz_from_cpuid(void) {
+    uint32_t max_leaf = cpuid_eax(0x0);
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t crystal_khz;
+
+    if (max_leaf < CPUID_TSC_LEAF)
+        return 0;
+
+    ebx = ecx = edx = 0;
+    cpuid(CPUID_TSC_LEAF, &eax, &ebx, &ecx, &edx);
+    if (!eax || !ebx)
+        return 0;
+
+    crystal_khz = ecx / 1000;
+
+    /* No crystal frequency given: derive it from the base frequency */
+    if (!crystal_khz && max_leaf >= CPUID_FREQ_LEAF)
+        crystal_khz = (cpuid_eax(CPUID_FREQ_LEAF) & 0xffff) * 1000 * eax / ebx;
+
+    return crystal_khz * ebx / eax;
+}
+
+/* Count TSC cycles between global timer (HPET or PIT) ticks */
+static uint64_t tsc_khz_from_timer(void) {
+    uint64_t start_tsc, end_tsc;
+    time_t start;
+
+    if (!boot_flags.timer_global || !interrupts_enabled())
+        return 0;
+
+    /* Align with a tick edge on both ends */
+    start = get_timer_ticks();
+    while (get_timer_ticks() == start)
+        cpu_relax();
+    start_tsc = rdtscp();
+    start = get_timer_ticks();
+
+    while (get_timer_ticks() < start + TSC_CAL_TICKS)
+        cpu_relax();
+    end_tsc = rdtscp();
+
+    return (end_tsc - start_tsc) / TSC_CAL_TICKS;
+}
+
+static uint64_t tsc_khz_from_brand(void) {
+    char cpu_str[49] = {0};
+
+    if (!cpu_vendor_string(cpu_str))
+        return 0;
+
+    return get_cpu_freq(cpu_str) / 1000;
+}
+
+void init_tsc(void) {
+    const char *source = "CPUID";
+
+    tsc_khz = tsc_khz_from_cpuid();
+    if (!tsc_khz) {
+        source = "timer calibration";
+        tsc_khz = tsc_khz_from_timer();
+    }
+    if (!tsc_khz) {
+        source = "CPU brand string";
+        tsc_khz = tsc_khz_from_brand();
+    }
+
+    if (!tsc_khz) {
+        warning("Unable to determine TSC frequency. Assuming 1 GHz");
+        source = "default";
+        tsc_khz = 1000000;
+    }
+
+    tsc_mult = (_U64(1000000) << 32) / tsc_khz;
+    printk("TSC frequency: %lu kHz (%s)\n", tsc_khz, source);
+}
+
+uint64_t get_tsc_khz(void) {
+    return tsc_khz;
+}
+
+bool is_tsc_synchronized(void) {
+    return tsc_synchronized;
+}
+
+uint64_t tsc_to_ns(uint64_t cycles) {
+    return ((unsigned __int128) cycles * tsc_mult) >> 32;
+}
+
+/* Nanoseconds since reset, as seen by the BSP's TSC */
+uint64_t ktime_ns(void) {
+    return tsc_to_ns(rdtscp() - PERCPU_GET(tsc_offset));
+}
+
+/* BSP side of the synchronization with a freshly booted AP. Each round the BSP
+ * reads its TSC, the AP reads its own and the BSP reads again once it saw the
+ * reply. The AP's read happened somewhere within that window, so with
+ * synchronized TSCs it must fall between the two BSP reads.
+ */
+void tsc_sync_source(cpu_t *cpu) {
+    uint64_t best_rtt = ULONG_MAX;
+    int64_t offset = 0;
+    bool warp = false;
+    unsigned long flags = interrupts_disable_save();
+
+    for (unsigned int round = 0; round < TSC_SYNC_ROUNDS; round++) {
+        uint64_t t0, t1, t2;
+
+        t0 = rdtscp();
+        tsc_sync.seq = 2 * round + 1;
+        while (tsc_sync.seq != 2 * round + 2)
+            cpu_relax();
+        t2 = rdtscp();
+        t1 = tsc_sync.target_tsc;
+
+        if (t1 < t0 || t1 > t2)
+            warp = true;
+
+        if (t2 - t0 < best_rtt) {
+            best_rtt = t2 - t0;
+            offset = (int64_t) (t1 - (t0 + best_rtt / 2));
+        }
+    }
+    tsc_sync.seq = 0;
+
+    interrupts_restore(flags);
+
+    /* Offsets within half of the round trip cannot be told apart from zero */
+    if ((uint64_t) (offset < 0 ? -offset : offset) <= best_rtt / 2)
+        offset = 0;
+
+    cpu->percpu->tsc_offset = offset;
+    if (warp) {
+        tsc_synchronized = false;
+        warning("CPU[%u]: TSC not synchronized with the BSP (offset %ld cycles, rtt %lu)",
+                cpu->id, offset, best_rtt);
+    }
+    else {
+        dprintk("CPU[%u]: TSC synchronized with the BSP (rtt %lu)\n", cpu->id, best_rtt);
+    }
+}
+
+/* AP side, running concurrently with tsc_sync_source() */
+void tsc_sync_target(cpu_t *cpu) {
+    unsigned long flags = interrupts_disable_save();
+
+    for (unsigned int round = 0; round < TSC_SYNC_ROUNDS; round++) {
+        while (tsc_sync.seq != 2 * round + 1)
+            cpu_relax();
+        tsc_sync.target_tsc = rdtscp();
+        smp_wmb();
+        tsc_sync.seq = 2 * round + 2;
+    }
+
+    interrupts_restore(flags);
+}
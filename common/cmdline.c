@@ -79,6 +79,30 @@ ulong_cmd("reboot_timeout", opt_reboot_timeout);
 bool opt_tlb_global = true;
 bool_cmd("tlb_global", opt_tlb_global);
 
+bool opt_sched_steal = false;
+bool_cmd("sched_steal", opt_sched_steal);
+
+bool opt_sched_preempt = false;
+bool_cmd("sched_preempt", opt_sched_preempt);
+
+unsigned long opt_sched_quantum = 10; /* In local APIC timer ticks (ms) */
+ulong_cmd("sched_quantum", opt_sched_quantum);
+
+bool opt_tickless = false;
+bool_cmd("tickless", opt_tickless);
+
+bool opt_printk_async = false;
+bool_cmd("printk_async", opt_printk_async);
+
+bool opt_serial_tx_irq = true;
+bool_cmd("serial_tx_irq", opt_serial_tx_irq);
+
+unsigned long opt_trace_size = 0; /* Per-CPU trace buffer in MB, disabled by default */
+ulong_cmd("trace_size", opt_trace_size);
+
+unsigned long opt_trace_port = 0; /* I/O port for binary trace dumps, else printk() */
+ulong_cmd("trace_port", opt_trace_port);
+
 const char *kernel_cmdline;
 
 void __text_init cmdline_parse(const char *cmdline) {
@@ -23,44 +23,260 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <atomic.h>
 #include <console.h>
+#include <cpu.h>
 #include <ktf.h>
 #include <lib.h>
+#include <list.h>
+#include <percpu.h>
 #include <setup.h>
 #include <spinlock.h>
 #include <string.h>
+#include <time.h>
+#include <timer.h>
 
 #include <drivers/fb.h>
 #include <drivers/serial.h>
 #include <drivers/vga.h>
 
+#include <mm/slab.h>
+#include <mm/vmm.h>
+
 #include <smp/smp.h>
 
 #define VPRINTK_BUF_SIZE 1024
 
+#define PRINTK_RING_SIZE PAGE_SIZE
+#define PRINTK_FLUSH_US  1000
+
 static console_callback_entry_t console_callbacks[2];
 static unsigned int num_console_callbacks;
 
+/* Serializes the console callbacks */
+static spinlock_t console_lock = SPINLOCK_INIT;
+
+/* Per-CPU log ring. Only the owning CPU (with interrupts disabled) advances the head,
+ * only the flusher (under console_lock) advances the tail, so neither side locks.
+ */
+struct printk_ring {
+    list_head_t list;
+    char *buf;
+    char *fmt_buf;
+    uint64_t head;
+    uint64_t tail;
+    unsigned int cpu;
+    bool midline; /* Last emitted record did not end its line */
+};
+typedef struct printk_ring printk_ring_t;
+
+struct printk_record {
+    uint64_t ns; /* ktime_ns(), comparable across CPUs */
+    uint32_t cpu;
+    uint32_t len;
+    char text[];
+};
+typedef struct printk_record printk_record_t;
+
+static DEFINE_PERCPU(printk_ring_t, printk_ring);
+static list_head_t printk_rings = LIST_INIT(printk_rings);
+static bool printk_async;
+static timer_t printk_flush_timer;
+
+static void console_write(const char *buf, size_t len) {
+    for (unsigned int i = 0; i < num_console_callbacks; i++) {
+        void *arg = console_callbacks[i].arg;
+
+        console_callbacks[i].cb(arg, buf, len);
+    }
+}
+
+static inline size_t printk_record_size(size_t len) {
+    return sizeof(printk_record_t) + div_round_up(len, sizeof(printk_record_t)) *
+                                         sizeof(printk_record_t);
+}
+
+/* Records are aligned to their header size, so a header never wraps around */
+static inline printk_record_t *printk_ring_record(printk_ring_t *ring, uint64_t pos) {
+    return (printk_record_t *) (ring->buf + (pos % PRINTK_RING_SIZE));
+}
+
+static bool printk_ring_write(printk_ring_t *ring, const char *msg, size_t len) {
+    uint64_t head = ring->head;
+    size_t size = printk_record_size(len);
+    printk_record_t *rec;
+    size_t off, first;
+
+    if (size > PRINTK_RING_SIZE - (head - load_acquire(&ring->tail)))
+        return false;
+
+    rec = printk_ring_record(ring, head);
+    rec->ns = ktime_ns();
+    rec->cpu = ring->cpu;
+    rec->len = len;
+
+    off = (head + sizeof(*rec)) % PRINTK_RING_SIZE;
+    first = min(len, PRINTK_RING_SIZE - off);
+    memcpy(ring->buf + off, msg, first);
+    memcpy(ring->buf, msg + first, len - first);
+
+    store_release(&ring->head, head + size);
+    return true;
+}
+
+/* Every line gets prefixed with its time and CPU. Called with console_lock held. */
+static void printk_ring_emit(printk_ring_t *ring, const printk_record_t *rec) {
+    static char text[VPRINTK_BUF_SIZE];
+    size_t off = (ring->tail + sizeof(*rec)) % PRINTK_RING_SIZE;
+    size_t first = min(rec->len, PRINTK_RING_SIZE - off);
+    size_t start, end;
+
+    memcpy(text, ring->buf + off, first);
+    memcpy(text + first, ring->buf, rec->len - first);
+
+    for (start = 0; start < rec->len; start = end) {
+        for (end = start; end < rec->len && text[end] != '\n'; end++)
+            ;
+        if (end < rec->len)
+            end++;
+
+        if (!ring->midline) {
+            char prefix[48];
+            int len;
+
+            len = snprintf(prefix, sizeof(prefix), "[%5lu.%06lu] CPU[%u]: ",
+                           rec->ns / 1000000000, (rec->ns / 1000) % 1000000, rec->cpu);
+
+            console_write(prefix, len);
+        }
+        console_write(text + start, end - start);
+        ring->midline = text[end - 1] != '\n';
+    }
+
+    store_release(&ring->tail, ring->tail + printk_record_size(rec->len));
+}
+
+/* Drain all rings to the consoles, merging their records in timestamp order.
+ * Called with console_lock held.
+ */
+static void __printk_flush(void) {
+    for (;;) {
+        printk_ring_t *ring, *oldest = NULL;
+        printk_record_t *rec, *oldest_rec = NULL;
+
+        list_for_each_entry (ring, &printk_rings, list) {
+            if (ring->tail == load_acquire(&ring->head))
+                continue;
+
+            rec = printk_ring_record(ring, ring->tail);
+            if (!oldest || rec->ns < oldest_rec->ns) {
+                oldest = ring;
+                oldest_rec = rec;
+            }
+        }
+
+        if (!oldest)
+            break;
+
+        printk_ring_emit(oldest, oldest_rec);
+    }
+}
+
+void printk_flush(void) {
+    unsigned long flags = spin_lock_irqsave(&console_lock);
+
+    __printk_flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/* Switch printk() and the serial ports back to synchronous writes and drain
+ * the rings
+ */
+void printk_sync(void) {
+    store_release(&printk_async, false);
+    printk_flush();
+    serial_sync();
+}
+
+static void printk_flush_timer_handler(timer_t *timer) {
+    spin_lock(&console_lock);
+    __printk_flush();
+    spin_unlock(&console_lock);
+
+    if (ACCESS_ONCE(printk_async))
+        add_timer(timer, rdtsc() + us_to_tsc(PRINTK_FLUSH_US));
+}
+
+static void init_printk_ring(percpu_t *percpu) {
+    printk_ring_t *ring = per_cpu_ptr(printk_ring, percpu);
+
+    ring->buf = get_free_page(GFP_KERNEL_MAP);
+    ring->fmt_buf = kmalloc(VPRINTK_BUF_SIZE);
+    BUG_ON(!ring->buf || !ring->fmt_buf);
+
+    ring->head = ring->tail = 0;
+    ring->cpu = percpu->cpu ? percpu->cpu->id : percpu->apic_id;
+    ring->midline = false;
+    list_add_tail(&ring->list, &printk_rings);
+}
+
+/* Log into per-CPU rings, drained by a local APIC timer on the BSP. Must be called
+ * on the BSP once all CPUs are up.
+ */
+void init_printk_async(void) {
+    if (!PERCPU_GET(apic_timer_enabled)) {
+        warning("Asynchronous printk requires the local APIC timer (apic_timer)");
+        return;
+    }
+
+    printk("Enabling asynchronous printk\n");
+    for_each_percpu(init_printk_ring);
+
+    init_timer(&printk_flush_timer, printk_flush_timer_handler, NULL);
+    store_release(&printk_async, true);
+    add_timer(&printk_flush_timer, rdtsc() + us_to_tsc(PRINTK_FLUSH_US));
+}
+
 void vprintk(const char *fmt, va_list args) {
     static char buf[VPRINTK_BUF_SIZE];
-    static spinlock_t lock = SPINLOCK_INIT;
-    unsigned int i;
+    unsigned long flags;
     int rc;
 
-    spin_lock(&lock);
+    /* The ring (or the lock holder) must not be reentered from interrupts */
+    flags = interrupts_disable_save();
+
+    if (ACCESS_ONCE(printk_async)) {
+        printk_ring_t *ring = this_cpu_ptr(printk_ring);
+
+        rc = vsnprintf(ring->fmt_buf, VPRINTK_BUF_SIZE, fmt, args);
+        if (rc > VPRINTK_BUF_SIZE)
+            panic("vprintk() buffer overflow");
+
+        if (printk_ring_write(ring, ring->fmt_buf, rc)) {
+            interrupts_restore(flags);
+            return;
+        }
+
+        /* Ring full: drain all rings and write out synchronously */
+        spin_lock(&console_lock);
+        __printk_flush();
+        console_write(ring->fmt_buf, rc);
+        spin_unlock(&console_lock);
+        interrupts_restore(flags);
+        return;
+    }
+
+    spin_lock(&console_lock);
 
     rc = vsnprintf(buf, sizeof(buf), fmt, args);
 
     if (rc > (int) sizeof(buf))
         panic("vprintk() buffer overflow");
 
-    for (i = 0; i < num_console_callbacks; i++) {
-        void *arg = console_callbacks[i].arg;
+    console_write(buf, rc);
 
-        console_callbacks[i].cb(arg, buf, rc);
-    }
-
-    spin_unlock(&lock);
+    spin_unlock(&console_lock);
+    interrupts_restore(flags);
 }
 
 void printk(const char *fmt, ...) {
@@ -143,6 +359,8 @@ static void oops_print(const char *fmt, va_list args, const char *type) {
 void panic(const char *fmt, ...) {
     va_list args;
 
+    printk_sync();
+
     va_start(args, fmt);
     oops_print(fmt, args, "PANIC");
     va_end(args);
@@ -24,15 +24,20 @@
  */
 #include <console.h>
 #include <cpu.h>
+#include <cpuid.h>
 #include <ktf.h>
 #include <lib.h>
 #include <list.h>
+#include <rwlock.h>
+#include <sched.h>
 #include <spinlock.h>
 #include <string.h>
 
 #include <mm/slab.h>
 
 static list_head_t cpus;
+/* Writers only add CPUs during boot, all other users just walk the list */
+static rwlock_t cpus_lock = RWLOCK_INIT;
 static unsigned int nr_cpus = 0;
 
 static cpu_t bsp = {0};
@@ -49,9 +54,17 @@ static void init_cpu(cpu_t *cpu, unsigned int id, bool is_bsp, bool enabled) {
 
     cpu->percpu = get_percpu_page(id);
     BUG_ON(!cpu->percpu);
+    cpu->percpu->cpu = cpu;
 
-    cpu->lock = SPINLOCK_INIT;
+    spin_lock_init(&cpu->lock);
+    mpsc_init(&cpu->run_queue);
     list_init(&cpu->task_queue);
+    list_init(&cpu->steal_queue);
+    list_init(&cpu->task_stacks);
+    list_init(&cpu->dead_tasks);
+    list_init(&cpu->timers);
+    init_timer(&cpu->slice_timer, NULL, NULL);
+    cpu->nr_steal_tasks = 0;
 }
 
 cpu_t *init_cpus(void) {
@@ -68,14 +81,17 @@ cpu_t *init_cpus(void) {
 
 cpu_t *add_cpu(unsigned int id, bool is_bsp, bool enabled) {
     cpu_t *cpu = kzalloc(sizeof(*cpu));
+    unsigned long flags;
 
     if (!cpu)
         return NULL;
 
     init_cpu(cpu, id, is_bsp, enabled);
 
+    flags = write_lock_irqsave(&cpus_lock);
     list_add(&cpu->list, &cpus);
     nr_cpus++;
+    write_unlock_irqrestore(&cpus_lock, flags);
 
     return cpu;
 }
@@ -83,12 +99,16 @@ cpu_t *add_cpu(unsigned int id, bool is_bsp, bool enabled) {
 cpu_t *get_cpu(unsigned int id) {
     cpu_t *cpu;
 
+    read_lock(&cpus_lock);
     list_for_each_entry (cpu, &cpus, list) {
         if (cpu->id == id)
-            return cpu;
+            goto out;
     }
+    cpu = NULL;
 
-    return NULL;
+out:
+    read_unlock(&cpus_lock);
+    return cpu;
 }
 
 unsigned int get_nr_cpus(void) {
@@ -99,42 +119,129 @@ cpu_t *get_bsp_cpu(void) {
     return &bsp;
 }
 
+/* Return the next enabled CPU after the given one (wrapping around),
+ * or the first enabled CPU when cpu is NULL.
+ */
+cpu_t *get_next_cpu(const cpu_t *cpu) {
+    cpu_t *next_cpu = NULL;
+    list_head_t *next;
+
+    read_lock(&cpus_lock);
+    next = cpu ? cpu->list.next : cpus.next;
+    for (unsigned int i = 0; i <= nr_cpus; i++, next = next->next) {
+        if (next == &cpus)
+            next = next->next;
+
+        next_cpu = list_entry(next, cpu_t, list);
+        if (is_cpu_enabled(next_cpu))
+            break;
+        next_cpu = NULL;
+    }
+    read_unlock(&cpus_lock);
+
+    return next_cpu;
+}
+
 void for_each_cpu(void (*func)(cpu_t *cpu)) {
     cpu_t *cpu;
 
+    read_lock(&cpus_lock);
     list_for_each_entry (cpu, &cpus, list)
         func(cpu);
+    read_unlock(&cpus_lock);
 }
 
 void unblock_all_cpus(void) {
     cpu_t *cpu;
 
-    list_for_each_entry (cpu, &cpus, list)
+    read_lock(&cpus_lock);
+    list_for_each_entry (cpu, &cpus, list) {
         set_cpu_unblocked(cpu);
+        wake_cpu(cpu);
+    }
+    read_unlock(&cpus_lock);
 }
 
 void block_all_cpus(void) {
     cpu_t *cpu;
 
+    read_lock(&cpus_lock);
     list_for_each_entry (cpu, &cpus, list)
         set_cpu_blocked(cpu);
+    read_unlock(&cpus_lock);
 }
 
 void finish_all_cpus(void) {
     cpu_t *cpu;
 
+    read_lock(&cpus_lock);
     list_for_each_entry (cpu, &cpus, list)
         set_cpu_finished(cpu);
+    read_unlock(&cpus_lock);
 }
 
 void wait_for_all_cpus(void) {
     cpu_t *cpu;
 
+    read_lock(&cpus_lock);
     list_for_each_entry (cpu, &cpus, list) {
         if (is_cpu_bsp(cpu))
             continue;
 
-        while (!is_cpu_finished(cpu) || !list_is_empty(&cpu->task_queue))
-            cpu_relax();
+        cpu_wait(&cpu->run_state,
+                 is_cpu_finished(cpu) && get_cpu_nr_tasks(cpu, TASK_GROUP_ALL) == 0);
+    }
+    read_unlock(&cpus_lock);
+}
+
+/* The APIC ID layout is taken from the BSP, it is the same on all CPUs */
+void init_cpu_topology(void) {
+    cpuid_topology_t topo;
+    cpu_t *cpu;
+
+    if (!cpuid_get_topology(&topo))
+        warning("CPUID topology leaves not available. SMT siblings reported as cores");
+
+    read_lock(&cpus_lock);
+    list_for_each_entry (cpu, &cpus, list) {
+        uint32_t apic_id = cpu->percpu->apic_id;
+
+        if (cpu->id >= MAX_CPUS)
+            warning("CPU[%u]: ID out of CPU mask range (%u)", cpu->id, MAX_CPUS);
+
+        cpu->topology.thread = apic_id & ((1U << topo.smt_shift) - 1);
+        cpu->topology.core =
+            (apic_id & ((1U << topo.package_shift) - 1)) >> topo.smt_shift;
+        cpu->topology.package = apic_id >> topo.package_shift;
+
+        printk("CPU[%u]: Package %u, Core %u, Thread %u\n", cpu->id,
+               cpu->topology.package, cpu->topology.core, cpu->topology.thread);
+    }
+    read_unlock(&cpus_lock);
+}
+
+/* All enabled CPUs sharing the physical core with cpu, including itself */
+void get_cpu_siblings(const cpu_t *cpu, cpumask_t *mask) {
+    cpu_t *c;
+
+    cpumask_clear(mask);
+    read_lock(&cpus_lock);
+    list_for_each_entry (c, &cpus, list) {
+        if (is_cpu_enabled(c) && c->topology.package == cpu->topology.package &&
+            c->topology.core == cpu->topology.core)
+            cpumask_set_cpu(mask, c->id);
+    }
+    read_unlock(&cpus_lock);
+}
+
+void get_cpus_mask(cpumask_t *mask) {
+    cpu_t *cpu;
+
+    cpumask_clear(mask);
+    read_lock(&cpus_lock);
+    list_for_each_entry (cpu, &cpus, list) {
+        if (is_cpu_enabled(cpu))
+            cpumask_set_cpu(mask, cpu->id);
     }
+    read_unlock(&cpus_lock);
 }
@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <apic.h>
+#include <cmdline.h>
+#include <console.h>
+#include <cpu.h>
+#include <idle.h>
+#include <ktf.h>
+#include <lib.h>
+#include <string.h>
+#include <traps.h>
+
+#define CPUID_FEATURE_MONITOR    (_U32(1) << 3)
+#define CPUID_FEATURE_HYPERVISOR (_U32(1) << 31)
+
+static char opt_idle[8];
+string_cmd("idle", opt_idle);
+
+idle_mode_t idle_mode = IDLE_MODE_POLL;
+
+/* CPUs halted in cpu_wait(), woken up by wake_waiters() */
+static cpumask_t waiting_cpus;
+static cpu_t *waiters[MAX_CPUS];
+
+static const char *const idle_mode_names[] = {
+    [IDLE_MODE_POLL] = "poll",
+    [IDLE_MODE_HLT] = "hlt",
+    [IDLE_MODE_MWAIT] = "mwait",
+};
+
+static inline bool cpu_has_monitor(void) {
+    return !!(cpuid_ecx(0x1) & CPUID_FEATURE_MONITOR);
+}
+
+static inline bool cpu_has_hypervisor(void) {
+    return !!(cpuid_ecx(0x1) & CPUID_FEATURE_HYPERVISOR);
+}
+
+const char *idle_mode_name(idle_mode_t mode) {
+    return idle_mode_names[mode];
+}
+
+bool set_idle_mode(idle_mode_t mode) {
+    if (mode == IDLE_MODE_MWAIT && !cpu_has_monitor())
+        return false;
+
+    ACCESS_ONCE(idle_mode) = mode;
+    return true;
+}
+
+/* MWAIT is preferred on bare metal. Hypervisors often do not expose it or emulate
+ * it poorly, so HLT with wakeup IPIs is the default there.
+ */
+void __text_init init_idle(void) {
+    idle_mode_t mode = IDLE_MODE_HLT;
+
+    if (cpu_has_monitor() && !cpu_has_hypervisor())
+        mode = IDLE_MODE_MWAIT;
+
+    if (!string_empty(opt_idle)) {
+        unsigned int i;
+
+        for (i = 0; i < ARRAY_SIZE(idle_mode_names); i++) {
+            if (string_equal(opt_idle, idle_mode_names[i]))
+                break;
+        }
+
+        if (i < ARRAY_SIZE(idle_mode_names))
+            mode = i;
+        else
+            warning("Unknown idle mode: %s", opt_idle);
+    }
+
+    if (!set_idle_mode(mode)) {
+        warning("Idle mode %s not supported", idle_mode_name(mode));
+        set_idle_mode(IDLE_MODE_HLT);
+    }
+
+    printk("Idle mode: %s\n", idle_mode_name(idle_mode));
+}
+
+/* An idle CPU announces its idle state and waits (mwait or halt) for wake_cpu() to
+ * clear it. HLT requires interrupts enabled, as the wakeup comes from an IPI.
+ * They stay disabled until the actual halt, so that the IPI cannot be lost.
+ * Without a cpu the caller waits in cpu_wait(): it monitors the addr in MWAIT mode
+ * and halts the current CPU as a waiter in HLT mode.
+ */
+unsigned long idle_prepare(cpu_t *cpu, const volatile void *addr) {
+    idle_mode_t mode = ACCESS_ONCE(idle_mode);
+    unsigned long flags = 0;
+
+    if (!cpu) {
+        if (mode == IDLE_MODE_MWAIT) {
+            monitor(addr, 0, 0);
+            return flags;
+        }
+
+        /* Waiters beyond the mask poll */
+        cpu = PERCPU_GET(cpu);
+        if (mode != IDLE_MODE_HLT || !cpu || cpu->id >= MAX_CPUS || !interrupts_enabled())
+            return flags;
+
+        flags = interrupts_disable_save();
+        ACCESS_ONCE(cpu->idle) = CPU_IDLE_HALT;
+        waiters[cpu->id] = cpu;
+        /* Locked, hence also orders the idle state before the cond recheck */
+        atomic_test_and_set_bit(cpu->id, waiting_cpus.bits);
+        return flags;
+    }
+
+    if (mode == IDLE_MODE_MWAIT) {
+        ACCESS_ONCE(cpu->idle) = CPU_IDLE_MWAIT;
+        monitor(&cpu->idle, 0, 0);
+    }
+    else if (mode == IDLE_MODE_HLT && interrupts_enabled()) {
+        flags = interrupts_disable_save();
+        ACCESS_ONCE(cpu->idle) = CPU_IDLE_HALT;
+    }
+    smp_mb();
+
+    return flags;
+}
+
+void idle_enter(cpu_t *cpu) {
+    bool waiter = !cpu;
+    idle_state_t state;
+
+    if (waiter)
+        cpu = PERCPU_GET(cpu);
+    state = cpu ? ACCESS_ONCE(cpu->idle) : CPU_AWAKE;
+
+    if (state == CPU_IDLE_HALT)
+        safe_halt();
+    else if (waiter ? idle_mode == IDLE_MODE_MWAIT : state == CPU_IDLE_MWAIT)
+        mwait(0, 0);
+    else
+        cpu_relax();
+}
+
+/* Saved flags are non-zero only, when interrupts got disabled for a halt */
+void idle_exit(cpu_t *cpu, unsigned long flags) {
+    if (!cpu) {
+        if (!flags)
+            return;
+
+        cpu = PERCPU_GET(cpu);
+        atomic_test_and_reset_bit(cpu->id, waiting_cpus.bits);
+        ACCESS_ONCE(cpu->idle) = CPU_AWAKE;
+        interrupts_restore(flags);
+        return;
+    }
+
+    ACCESS_ONCE(cpu->idle) = CPU_AWAKE;
+    if (flags)
+        interrupts_restore(flags);
+}
+
+/* Clearing the idle state wakes up a mwaiting CPU, a halted one needs an IPI */
+void wake_cpu(cpu_t *cpu) {
+    smp_mb();
+    if (ACCESS_ONCE(cpu->idle) == CPU_AWAKE)
+        return;
+
+    if (xchg(&cpu->idle, CPU_AWAKE) == CPU_IDLE_HALT)
+        apic_send_ipi(cpu->percpu->apic_id, WAKEUP_IRQ);
+}
+
+/* To be called after an update of a cond, that cpu_wait() callers may wait for */
+void wake_waiters(void) {
+    smp_mb();
+    for (unsigned int i = 0; i < ARRAY_SIZE(waiting_cpus.bits); i++) {
+        unsigned long bits = ACCESS_ONCE(waiting_cpus.bits[i]);
+
+        for (; bits; bits &= bits - 1)
+            wake_cpu(waiters[i * BITS_PER_LONG + __builtin_ffsl(bits) - 1]);
+    }
+}
+
+void wakeup_interrupt_handler(void) {
+    apic_EOI();
+}
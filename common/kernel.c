@@ -31,7 +31,9 @@
 #include <percpu.h>
 #include <sched.h>
 #include <setup.h>
+#include <spinlock.h>
 #include <time.h>
+#include <trace.h>
 #ifdef KTF_PMU
 #include <perfmon/pfmlib.h>
 #endif
@@ -77,6 +79,9 @@ void kernel_main(void) {
     printk("All tasks done.\n");
 
     execute_tasks();
+    trace_dump();
+    lockstat_report();
+    printk_sync();
 
 #ifdef KTF_PMU
     pfm_terminate();
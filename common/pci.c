@@ -26,9 +26,11 @@
 #include <mm/slab.h>
 #include <pci.h>
 #include <pci_cfg.h>
+#include <rwlock.h>
 #include <string.h>
 
 static list_head_t pci_list = LIST_INIT(pci_list);
+static rwlock_t pci_list_lock = RWLOCK_INIT;
 
 static inline uint8_t pci_dev_hdr_type(pcidev_t *dev) {
     return dev->hdr & PCI_HDR_TYPE;
@@ -89,7 +91,9 @@ static void probe_pci_bus(uint8_t bus, uint8_t start_dev, pcidev_t *bridge) {
             snprintf(&new_dev->bdf_str[0], sizeof(new_dev->bdf_str), "%02x:%02x.%02x",
                      bus, dev, func);
 
+            write_lock(&pci_list_lock);
             list_add_tail(&new_dev->list, &pci_list);
+            write_unlock(&pci_list_lock);
 
             if (pci_dev_hdr_type(new_dev) == PCI_HDR_TYPE_PCI_BRIDGE) {
                 uint8_t secondary, subordinate;
@@ -147,7 +151,9 @@ static void probe_pci(void) {
     host_bridge->bridge = NULL;
 
     strncpy(&host_bridge->bdf_str[0], "00:0.0", sizeof(host_bridge->bdf_str));
+    write_lock(&pci_list_lock);
     list_add_tail(&host_bridge->list, &pci_list);
+    write_unlock(&pci_list_lock);
 
     /* Probe the rest of bus 0 */
     probe_pci_bus(0, 1, host_bridge);
@@ -159,7 +165,9 @@ void init_pci(void) {
     printk("Initializing PCI\n");
     probe_pci();
 
+    read_lock(&pci_list_lock);
     list_for_each_entry (dev, &pci_list, list) {
         printk("pci: found device at %s\n", &dev->bdf_str[0]);
     }
+    read_unlock(&pci_list_lock);
 }
@@ -22,21 +22,41 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <atomic.h>
 #include <console.h>
 #include <ktf.h>
 #include <lib.h>
 #include <list.h>
 #include <percpu.h>
+#include <spinlock.h>
 #include <string.h>
 
 #include <mm/vmm.h>
 
+#define PERCPU_UNIT_SIZE 16
+#define PERCPU_NR_UNITS  (PAGE_SIZE / PERCPU_UNIT_SIZE)
+
 static list_head_t percpu_frames;
+static spinlock_t percpu_lock = SPINLOCK_INIT;
+
+/* alloc_percpu() units of the per-CPU area, behind the DEFINE_PERCPU() variables */
+static unsigned long percpu_units[PERCPU_NR_UNITS / BITS_PER_LONG];
+static unsigned int percpu_first_unit, percpu_nr_units;
+
+static inline size_t percpu_static_size(void) {
+    return _ul(__end_percpu) - _ul(__start_percpu);
+}
 
 void init_percpu(void) {
     printk("Initialize Per CPU structures\n");
 
     list_init(&percpu_frames);
+
+    BUG_ON(percpu_static_size() > PERCPU_AREA_SIZE);
+    percpu_first_unit = div_round_up(percpu_static_size(), PERCPU_UNIT_SIZE);
+    percpu_nr_units = PERCPU_AREA_SIZE / PERCPU_UNIT_SIZE - percpu_first_unit;
+    dprintk("Per CPU area: %lu bytes, %lu bytes of static variables\n",
+            PERCPU_AREA_SIZE, percpu_static_size());
 }
 
 percpu_t *get_percpu_page(unsigned int cpu) {
@@ -55,8 +75,12 @@ percpu_t *get_percpu_page(unsigned int cpu) {
     memset(percpu, 0, PAGE_SIZE);
 
     percpu->apic_id = cpu;
+    percpu->self = percpu;
+    memcpy(percpu->area, __start_percpu, percpu_static_size());
 
+    spin_lock(&percpu_lock);
     list_add(&percpu->list, &percpu_frames);
+    spin_unlock(&percpu_lock);
     return percpu;
 }
 
@@ -66,3 +90,57 @@ void for_each_percpu(void (*func)(percpu_t *percpu)) {
     list_for_each_entry (percpu, &percpu_frames, list)
         func(percpu);
 }
+
+static inline bool percpu_unit_used(unsigned int unit) {
+    return atomic_test_bit(unit, percpu_units);
+}
+
+/* Allocate size bytes in the per-CPU area of every CPU, zeroed. Returns the offset
+ * for percpu_read(), percpu_ptr() and friends, or 0 when the area is exhausted.
+ */
+percpu_off_t alloc_percpu(size_t size) {
+    unsigned int units = div_round_up(size, PERCPU_UNIT_SIZE);
+    percpu_off_t off = 0;
+    percpu_t *percpu;
+
+    if (size == 0)
+        return 0;
+
+    spin_lock(&percpu_lock);
+    for (unsigned int first = 0, n = 0; first + units <= percpu_nr_units; first++) {
+        for (n = 0; n < units && !percpu_unit_used(first + n); n++)
+            ;
+
+        if (n < units) {
+            first += n;
+            continue;
+        }
+
+        for (n = 0; n < units; n++)
+            atomic_test_and_set_bit(first + n, percpu_units);
+
+        off = PERCPU_AREA_OFFSET + (percpu_first_unit + first) * PERCPU_UNIT_SIZE;
+        list_for_each_entry (percpu, &percpu_frames, list)
+            memset(percpu_ptr(percpu, off), 0, units * PERCPU_UNIT_SIZE);
+        break;
+    }
+    spin_unlock(&percpu_lock);
+
+    return off;
+}
+
+void free_percpu(percpu_off_t off, size_t size) {
+    unsigned int units = div_round_up(size, PERCPU_UNIT_SIZE);
+    unsigned int first;
+
+    if (off == 0)
+        return;
+
+    first = (off - PERCPU_AREA_OFFSET) / PERCPU_UNIT_SIZE - percpu_first_unit;
+    BUG_ON(first + units > percpu_nr_units);
+
+    spin_lock(&percpu_lock);
+    for (unsigned int n = 0; n < units; n++)
+        atomic_test_and_reset_bit(first + n, percpu_units);
+    spin_unlock(&percpu_lock);
+}
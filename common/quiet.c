@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <apic.h>
+#include <cmdline.h>
+#include <console.h>
+#include <cpu.h>
+#include <errno.h>
+#include <ioapic.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <quiet.h>
+#include <spinlock.h>
+#include <timer.h>
+#include <traps.h>
+
+#include <smp/smp.h>
+
+static spinlock_t quiet_lock = SPINLOCK_INIT;
+static bool quiet_open;
+
+/* CPUs, which are to have their local APIC timer stopped */
+static cpumask_t quiet_cpus;
+static atomic_t nr_quiet_pending;
+
+static DEFINE_PERCPU(bool, quiet_stopped);
+static DEFINE_PERCPU(uint32_t, quiet_lvt_timer);
+
+/* Stop or restart the local APIC timer, as quiet_cpus says. Interrupts disabled. */
+static void quiet_update_timer(void) {
+    unsigned int id = PERCPU_GET(cpu)->id;
+    bool stop = id < MAX_CPUS && cpumask_test_cpu(&quiet_cpus, id);
+    apic_lvt_timer_t timer;
+
+    if (stop == this_cpu_read(quiet_stopped))
+        return;
+
+    if (stop) {
+        timer.reg = apic_read(APIC_LVT_TIMER);
+        this_cpu_write(quiet_lvt_timer, timer.reg);
+        timer.mask = 1;
+        apic_write(APIC_LVT_TIMER, timer.reg);
+    }
+    else {
+        apic_write(APIC_LVT_TIMER, this_cpu_read(quiet_lvt_timer));
+
+        /* Tickless timers expiring within the window have been missed */
+        if (opt_tickless && PERCPU_GET(apic_timer_enabled))
+            run_timers();
+    }
+
+    this_cpu_write(quiet_stopped, stop);
+}
+
+void quiet_interrupt_handler(void) {
+    quiet_update_timer();
+    atomic_dec(&nr_quiet_pending);
+    apic_EOI();
+}
+
+/* The other CPUs of the window update their timers from an IPI. Returns once
+ * all of them did.
+ */
+static void quiet_update_cpus(const cpumask_t *cpus) {
+    cpu_t *self = PERCPU_GET(cpu), *first = get_next_cpu(NULL), *cpu = first;
+    unsigned long flags;
+
+    smp_mb();
+    do {
+        if (cpu != self && cpu->id < MAX_CPUS && cpumask_test_cpu(cpus, cpu->id)) {
+            atomic_inc(&nr_quiet_pending);
+            apic_send_ipi(cpu->percpu->apic_id, QUIET_IRQ);
+        }
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first);
+
+    flags = interrupts_disable_save();
+    quiet_update_timer();
+    interrupts_restore(flags);
+
+    while (atomic_read(&nr_quiet_pending) > 0)
+        cpu_relax();
+}
+
+int quiet_enter(quiet_window_t *window, const cpumask_t *cpus,
+                const uint32_t *keep_gsis, unsigned int nr_keep) {
+    unsigned nr_masked;
+
+    spin_lock(&quiet_lock);
+    if (quiet_open) {
+        spin_unlock(&quiet_lock);
+        return -EBUSY;
+    }
+    quiet_open = true;
+    spin_unlock(&quiet_lock);
+
+    nr_masked = ioapic_quiesce(keep_gsis, nr_keep);
+    dprintk("Quiet mode: %u IOAPIC lines masked, %u CPUs stopped\n", nr_masked,
+            cpumask_weight(cpus));
+
+    window->cpus = *cpus;
+    quiet_cpus = *cpus;
+    quiet_update_cpus(&window->cpus);
+
+    window->irq_count = PERCPU_GET(irq_count);
+    window->start_tsc = rdtsc();
+    return 0;
+}
+
+/* Returns the number of interrupts taken by the calling CPU within the window */
+unsigned long quiet_exit(quiet_window_t *window) {
+    unsigned long irqs = PERCPU_GET(irq_count) - window->irq_count;
+    uint64_t cycles = rdtsc() - window->start_tsc;
+
+    cpumask_clear(&quiet_cpus);
+    quiet_update_cpus(&window->cpus);
+    ioapic_unquiesce();
+
+    spin_lock(&quiet_lock);
+    quiet_open = false;
+    spin_unlock(&quiet_lock);
+
+    if (irqs > 0) {
+        printk("CPU[%u]: %lu interrupts slipped through the quiet window (%lu cycles)\n",
+               smp_processor_id(), irqs, cycles);
+    }
+
+    return irqs;
+}
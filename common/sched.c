@@ -22,9 +22,11 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <cmdline.h>
 #include <console.h>
 #include <cpu.h>
 #include <errno.h>
+#include <idle.h>
 #include <ktf.h>
 #include <lib.h>
 #include <list.h>
@@ -32,19 +34,54 @@
 #include <setup.h>
 #include <spinlock.h>
 #include <string.h>
+#include <timer.h>
 #include <usermode.h>
 
 #include <smp/smp.h>
 
+#include <mm/pmm.h>
 #include <mm/slab.h>
 #include <mm/vmm.h>
 
+#define TASK_STACK_SIZE (4 * PAGE_SIZE)
+
+/* Initial stack frame of a preemptible task, as expected by context_switch() */
+struct task_frame {
+    unsigned long r15, r14, r13, r12, rbx, rbp;
+    unsigned long ip;
+};
+
+extern void context_switch(void **prev_sp, void *next_sp);
+extern void task_trampoline(void);
+
 static tid_t next_tid;
 
+/* Destroyed tasks are recycled, along with their user stack. Any CPU may return
+ * a task, taking one out is serialized by the lock.
+ */
+static mpsc_queue_t task_pool;
+static spinlock_t task_pool_lock = SPINLOCK_INIT;
+static atomic_t nr_pooled_tasks;
+
+struct task_dep {
+    list_head_t list;
+    task_t *task;
+};
+typedef struct task_dep task_dep_t;
+
 void init_tasks(void) {
     printk("Initializing tasks\n");
 
+    BUILD_BUG_ON(TASK_GROUP_TEST >= MAX_TASK_GROUPS);
+
+    if (opt_sched_preempt && !opt_apic_timer) {
+        warning("Preemptive scheduling requires the local APIC timer (apic_timer)");
+        opt_sched_preempt = false;
+    }
+
     next_tid = 0;
+    mpsc_init(&task_pool);
+    atomic_set(&nr_pooled_tasks, 0);
 }
 
 static const char *task_state_names[] = {
@@ -52,19 +89,62 @@ static const char *task_state_names[] = {
     [TASK_STATE_READY] = "READY",
     [TASK_STATE_SCHEDULED] = "SCHEDULED",
     [TASK_STATE_RUNNING] = "RUNNING",
+    [TASK_STATE_SUSPENDED] = "SUSPENDED",
     [TASK_STATE_DONE] = "DONE",
 };
 
 #define PAGE_ORDER_TASK PAGE_ORDER_4K
 
+/* Queueing time is measured from SCHEDULED to RUNNING. Running time is accumulated
+ * until the task is DONE, also across preemptions and yields. Both are folded into
+ * the aggregates of the task's CPU, which print_sched_stats() reports.
+ */
+static inline void update_task_stats(task_t *task, task_state_t state) {
+    task_stats_t *stats = &task->stats;
+    cpu_t *cpu = task->cpu;
+    uint64_t now = rdtsc();
+    uint64_t delta = now - stats->state_tsc;
+
+    switch (task->state) {
+    case TASK_STATE_SCHEDULED:
+        if (state == TASK_STATE_RUNNING)
+            cpu->wait_cycles += delta;
+        break;
+    case TASK_STATE_RUNNING:
+        stats->exec_cycles += delta;
+        cpu->busy_cycles += delta;
+        break;
+    default:
+        break;
+    }
+
+    if (state == TASK_STATE_DONE) {
+        if (!cpu->run_min || stats->exec_cycles < cpu->run_min)
+            cpu->run_min = stats->exec_cycles;
+        if (stats->exec_cycles > cpu->run_max)
+            cpu->run_max = stats->exec_cycles;
+        cpu->run_total += stats->exec_cycles;
+        stats->exec_cycles = 0;
+        cpu->nr_executed++;
+    }
+
+    stats->state_tsc = now;
+}
+
 static inline void set_task_state(task_t *task, task_state_t state) {
     ASSERT(task);
 
+    update_task_stats(task, state);
+
     dprintk("CPU[%u]: state transition %s -> %s\n", task->cpu->id,
             task_state_names[task->state], task_state_names[state]);
 
     ACCESS_ONCE(task->state) = state;
-    smp_mb();
+    /* wait_for_task_state() is only ever waiting for SCHEDULED */
+    if (state == TASK_STATE_SCHEDULED)
+        wake_waiters();
+    else
+        smp_mb();
 }
 
 static inline task_state_t get_task_state(task_t *task) {
@@ -77,34 +157,160 @@ static inline task_state_t get_task_state(task_t *task) {
     return state;
 }
 
+static task_t *get_pooled_task(void) {
+    mpsc_node_t *node;
+
+    if (mpsc_is_empty(&task_pool))
+        return NULL;
+
+    spin_lock(&task_pool_lock);
+    node = mpsc_pop(&task_pool);
+    spin_unlock(&task_pool_lock);
+
+    if (!node)
+        return NULL;
+
+    atomic_dec(&nr_pooled_tasks);
+    return mpsc_entry(node, task_t, run_node);
+}
+
+static inline void put_pooled_task(task_t *task) {
+    atomic_inc(&nr_pooled_tasks);
+    mpsc_push(&task_pool, &task->run_node);
+}
+
+unsigned int get_nr_pooled_tasks(void) {
+    return atomic_read(&nr_pooled_tasks);
+}
+
+/* Recycled tasks are reset in place, keeping their already mapped user stack */
 static task_t *create_task(void) {
-    task_t *task = kzalloc(sizeof(*task));
+    task_t *task = get_pooled_task();
+    void *stack = NULL;
+
+    if (task)
+        stack = task->stack;
+    else
+        task = kmalloc(sizeof(*task));
 
     if (!task)
         return NULL;
 
     memset(task, 0, sizeof(*task));
+    task->stack = stack;
     task->id = next_tid++;
     task->gid = TASK_GROUP_ALL;
     set_task_state(task, TASK_STATE_NEW);
     atomic_set(&task->exec_count, 0);
+    list_init(&task->dependents);
+    atomic_set(&task->nr_deps, 1);
     set_task_once(task);
 
     return task;
 }
 
-/* The caller should never use the parameter again after calling this function */
+static inline void account_task(task_t *task, cpu_t *cpu) {
+    atomic_inc(&cpu->nr_tasks[TASK_GROUP_ALL]);
+    if (task->gid != TASK_GROUP_ALL)
+        atomic_inc(&cpu->nr_tasks[task->gid]);
+}
+
+/* wait_for_task_group() and wait_for_all_cpus() wait for a count of 0 */
+static inline void unaccount_task(task_t *task, cpu_t *cpu) {
+    bool drained = false;
+
+    if (task->gid != TASK_GROUP_ALL && atomic_dec_return(&cpu->nr_tasks[task->gid]) == 0)
+        drained = true;
+    if (atomic_dec_return(&cpu->nr_tasks[TASK_GROUP_ALL]) == 0)
+        drained = true;
+
+    if (drained)
+        wake_waiters();
+}
+
+/* Stacks of preemptible tasks are carved out of 2M chunks and recycled per CPU.
+ * Nothing is allocated while a preempted task might hold the allocator locks.
+ */
+static bool add_task_stacks(cpu_t *cpu) {
+    void *chunk;
+
+    if (cpu->nr_preempted > 0)
+        return false;
+
+    chunk = get_free_pages(PAGE_ORDER_2M, GFP_KERNEL);
+    if (!chunk)
+        return false;
+
+    for (size_t off = 0; off < ORDER_TO_SIZE(PAGE_ORDER_2M); off += TASK_STACK_SIZE)
+        list_add_tail(chunk + off, &cpu->task_stacks);
+
+    return true;
+}
+
+static void *get_task_stack(cpu_t *cpu) {
+    list_head_t *stack;
+
+    if (list_is_empty(&cpu->task_stacks) && !add_task_stacks(cpu))
+        return NULL;
+
+    stack = cpu->task_stacks.next;
+    list_unlink(stack);
+    return stack;
+}
+
+static inline void put_task_stack(cpu_t *cpu, void *stack) {
+    list_add(stack, &cpu->task_stacks);
+}
+
+static void free_task(task_t *task) {
+    task_dep_t *dep, *safe;
+
+    list_for_each_entry_safe (dep, safe, &task->dependents, list) {
+        list_unlink(&dep->list);
+        kfree(dep);
+    }
+
+    put_pooled_task(task);
+}
+
+/* Free tasks destroyed with dependents while other tasks were preempted */
+static void reap_dead_tasks(cpu_t *cpu) {
+    task_t *task, *safe;
+
+    if (cpu->nr_preempted > 0)
+        return;
+
+    list_for_each_entry_safe (task, safe, &cpu->dead_tasks, list) {
+        list_unlink(&task->list);
+        free_task(task);
+    }
+}
+
+/* The caller should never use the parameter again after calling this function.
+ * Scheduled tasks are destroyed by their owning CPU only, so the unlink from its
+ * private task queue needs no locking.
+ */
 static void destroy_task(task_t *task) {
+    cpu_t *cpu = task ? task->cpu : NULL;
+
     if (!task)
         return;
 
-    spin_lock(&task->cpu->lock);
+    if (!cpu) {
+        free_task(task);
+        return;
+    }
+
     list_unlink(&task->list);
-    if (task->stack)
-        put_page_top(task->stack);
-    spin_unlock(&task->cpu->lock);
+    unaccount_task(task, cpu);
+    if (task->kstack)
+        put_task_stack(cpu, task->kstack);
 
-    kfree(task);
+    /* A preempted task might hold the allocator locks */
+    if (cpu->nr_preempted > 0 && !list_is_empty(&task->dependents))
+        list_add_tail(&task->list, &cpu->dead_tasks);
+    else
+        free_task(task);
 }
 
 static int prepare_task(task_t *task, const char *name, task_func_t func, void *arg,
@@ -118,7 +324,7 @@ static int prepare_task(task_t *task, const char *name, task_func_t func, void *
     task->func = func;
     task->arg = arg;
     task->type = type;
-    if (task->type == TASK_TYPE_USER) {
+    if (task->type == TASK_TYPE_USER && !task->stack) {
         task->stack = get_free_page_top(GFP_USER);
         if (!task->stack)
             return -ENOMEM;
@@ -131,8 +337,7 @@ static void wait_for_task_state(task_t *task, task_state_t state) {
     if (!task)
         return;
 
-    while (get_task_state(task) != state)
-        cpu_relax();
+    cpu_wait(&task->state, get_task_state(task) == state);
 }
 
 task_t *new_task(const char *name, task_func_t func, void *arg, task_type_t type) {
@@ -149,6 +354,7 @@ task_t *new_task(const char *name, task_func_t func, void *arg, task_type_t type
     return task;
 }
 
+/* Only reliable when called on the CPU owning the task queue */
 task_t *get_task_by_name(cpu_t *cpu, const char *name) {
     task_t *task;
 
@@ -174,6 +380,124 @@ static const char *task_repeat_string(task_repeat_t repeat) {
     }
 }
 
+/* Make the task run only after dep has completed, i.e. after its last repetition
+ * is DONE. Neither task may be scheduled yet and the dependencies must not form
+ * a cycle. A dependency on a TASK_REPEAT_LOOP task is never satisfied.
+ */
+int task_depends_on(task_t *task, task_t *dep) {
+    task_dep_t *edge;
+
+    ASSERT(task && dep);
+
+    if (task == dep || get_task_state(task) != TASK_STATE_READY ||
+        get_task_state(dep) != TASK_STATE_READY)
+        return -EINVAL;
+
+    edge = kzalloc(sizeof(*edge));
+    if (!edge)
+        return -ENOMEM;
+
+    edge->task = task;
+    list_add_tail(&edge->list, &dep->dependents);
+    atomic_inc(&task->nr_deps);
+
+    return ESUCCESS;
+}
+
+/* Scheduling counts as one dependency, so whoever drops the last one queues
+ * the task.
+ */
+static inline bool put_task_dependency(task_t *task) {
+    return atomic_dec_and_test(&task->nr_deps);
+}
+
+static inline bool is_task_allowed(const task_t *task, const cpu_t *cpu) {
+    return cpumask_empty(&task->affinity) || cpumask_test_cpu(&task->affinity, cpu->id);
+}
+
+/* Wait-free: any CPU may add tasks to a CPU's run queue */
+static void push_task(task_t *task, cpu_t *cpu) {
+    mpsc_push(&cpu->run_queue, &task->run_node);
+    wake_cpu(cpu);
+}
+
+static void push_steal_task(task_t *task, cpu_t *cpu) {
+    spin_lock(&cpu->lock);
+    list_add_tail(&task->list, &cpu->steal_queue);
+    cpu->nr_steal_tasks++;
+    spin_unlock(&cpu->lock);
+    wake_cpu(cpu);
+}
+
+/* Tasks with unmet dependencies are accounted to the CPU, but held back.
+ * Returns true when the task is ready to be queued.
+ */
+static bool account_scheduled_task(task_t *task, cpu_t *cpu) {
+    task->cpu = cpu;
+    account_task(task, cpu);
+    set_task_state(task, TASK_STATE_SCHEDULED);
+
+    return put_task_dependency(task);
+}
+
+static void enqueue_task(task_t *task, cpu_t *cpu) {
+    if (!account_scheduled_task(task, cpu))
+        return;
+
+    if (task->balanced && opt_sched_steal)
+        push_steal_task(task, cpu);
+    else
+        push_task(task, cpu);
+}
+
+/* Transfer task accounting to the current CPU. The previous CPU may be waiting
+ * for its tasks, so wake it up.
+ */
+static void move_task(task_t *task, cpu_t *cpu) {
+    cpu_t *prev = task->cpu;
+
+    if (prev == cpu)
+        return;
+
+    account_task(task, cpu);
+    task->cpu = cpu;
+    unaccount_task(task, prev);
+    wake_cpu(prev);
+}
+
+/* Queue the tasks waiting for the completed task. Tasks without a hard CPU
+ * affinity are run right away by the current CPU, which has just become free.
+ */
+static void release_dependents(task_t *task) {
+    cpu_t *cpu = task->cpu;
+    task_dep_t *dep;
+
+    list_for_each_entry (dep, &task->dependents, list) {
+        task_t *next = dep->task;
+
+        if (!put_task_dependency(next))
+            continue;
+
+        dprintk("CPU[%u]: Releasing task %s[%u]\n", cpu->id, next->name, next->id);
+
+        if (next->balanced && is_task_allowed(next, cpu)) {
+            move_task(next, cpu);
+            list_add_tail(&next->list, &cpu->task_queue);
+        }
+        else {
+            push_task(next, next->cpu);
+        }
+    }
+}
+
+/* Move newly scheduled tasks onto the owner CPU's private task queue */
+static void dequeue_new_tasks(cpu_t *cpu) {
+    mpsc_node_t *node;
+
+    while ((node = mpsc_pop(&cpu->run_queue)))
+        list_add_tail(&mpsc_entry(node, task_t, run_node)->list, &cpu->task_queue);
+}
+
 int schedule_task(task_t *task, cpu_t *cpu) {
     ASSERT(task);
 
@@ -182,30 +506,466 @@ int schedule_task(task_t *task, cpu_t *cpu) {
         return -EEXIST;
     }
 
+    if (!is_task_allowed(task, cpu)) {
+        warning("Unable to schedule task: %s. CPU[%u] not in its affinity mask.",
+                task->name, cpu->id);
+        return -EINVAL;
+    }
+
+    ASSERT(get_task_state(task) == TASK_STATE_READY);
+
+    dprintk("CPU[%u]: Scheduling task %s[%u] (%s)\n", cpu->id, task->name, task->id,
+            task_repeat_string(task->repeat));
+
+    enqueue_task(task, cpu);
+
+    return 0;
+}
+
+/* Schedule a batch of tasks on a CPU. The batch is published onto the CPU's run
+ * queue at once and the CPU is woken up only once. With work-stealing enabled,
+ * balanced tasks go onto the CPU's steal queue instead.
+ */
+int schedule_tasks_batch(task_t *tasks[], unsigned int n, cpu_t *cpu) {
+    mpsc_node_t *first = NULL, *last = NULL;
+
+    if (!cpu) {
+        warning("Unable to schedule batch of %u tasks. CPU does not exist.", n);
+        return -EEXIST;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        ASSERT(tasks[i]);
+        if (!is_task_allowed(tasks[i], cpu)) {
+            warning("Unable to schedule task: %s. CPU[%u] not in its affinity mask.",
+                    tasks[i]->name, cpu->id);
+            return -EINVAL;
+        }
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        task_t *task = tasks[i];
+
+        ASSERT(get_task_state(task) == TASK_STATE_READY);
+
+        if (!account_scheduled_task(task, cpu))
+            continue;
+
+        /* Balanced tasks stay stealable, as with enqueue_task() */
+        if (task->balanced && opt_sched_steal) {
+            push_steal_task(task, cpu);
+            continue;
+        }
+
+        if (last)
+            last->next = &task->run_node;
+        else
+            first = &task->run_node;
+        last = &task->run_node;
+    }
+
+    dprintk("CPU[%u]: Scheduling batch of %u tasks\n", cpu->id, n);
+
+    if (first) {
+        mpsc_push_chain(&cpu->run_queue, first, last);
+        wake_cpu(cpu);
+    }
+
+    return 0;
+}
+
+/* Create and schedule one kernel task per enabled CPU. Nothing is scheduled
+ * unless all the tasks could be created.
+ */
+int schedule_on_all_cpus(const char *name, task_func_t func, void *arg) {
+    cpu_t *first_cpu = get_next_cpu(NULL), *cpu = first_cpu;
+    task_t *task, *safe;
+    list_head_t tasks;
+
+    list_init(&tasks);
+    do {
+        task = new_kernel_task(name, func, arg);
+        if (!task)
+            goto error;
+
+        task->cpu = cpu;
+        list_add_tail(&task->list, &tasks);
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first_cpu);
+
+    list_for_each_entry_safe (task, safe, &tasks, list) {
+        list_unlink(&task->list);
+        enqueue_task(task, task->cpu);
+    }
+
+    return 0;
+
+error:
+    list_for_each_entry_safe (task, safe, &tasks, list) {
+        list_unlink(&task->list);
+        free_task(task);
+    }
+    return -ENOMEM;
+}
+
+static bool cpu_placed_before(const cpu_t *a, const cpu_t *b, cpu_placement_t placement) {
+    const cpu_topology_t *ta = &a->topology, *tb = &b->topology;
+
+    if (placement == CPU_PLACEMENT_SPREAD && ta->thread != tb->thread)
+        return ta->thread < tb->thread;
+    if (ta->package != tb->package)
+        return ta->package < tb->package;
+    if (ta->core != tb->core)
+        return ta->core < tb->core;
+    return ta->thread < tb->thread;
+}
+
+/* Schedule tasks on CPUs ordered by topology: either spread across the physical
+ * cores or packed onto SMT siblings. A task is placed on the next CPU in order
+ * allowed by its affinity mask.
+ */
+int schedule_tasks_placed(task_t *tasks[], unsigned int n, cpu_placement_t placement) {
+    cpu_t *first_cpu = get_next_cpu(NULL), *cpu = first_cpu;
+    unsigned int nr_cpus = 0;
+    cpu_t **order;
+    int rc = 0;
+
+    order = kmalloc(get_nr_cpus() * sizeof(*order));
+    if (!order)
+        return -ENOMEM;
+
+    /* Insertion sort, it runs once per batch of tasks */
+    do {
+        unsigned int i = nr_cpus++;
+
+        for (; i > 0 && cpu_placed_before(cpu, order[i - 1], placement); i--)
+            order[i] = order[i - 1];
+        order[i] = cpu;
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first_cpu);
+
+    for (unsigned int i = 0, next = 0; i < n && rc == 0; i++) {
+        rc = -EINVAL;
+        for (unsigned int j = 0; j < nr_cpus; j++) {
+            cpu = order[(next + j) % nr_cpus];
+            if (is_task_allowed(tasks[i], cpu)) {
+                next = (next + j + 1) % nr_cpus;
+                rc = schedule_task(tasks[i], cpu);
+                break;
+            }
+        }
+    }
+
+    kfree(order);
+    return rc;
+}
+
+/* Last CPU of the round-robin placement. The BSP resets it at the end of its
+ * run_tasks(), so that every batch starts over with the first CPU.
+ */
+static cpu_t *balanced_cpu;
+
+/* Tasks without a hard CPU affinity are distributed round-robin across the CPUs
+ * of their affinity mask. With work-stealing enabled (sched_steal) they are kept
+ * on per-CPU steal queues instead: the owning CPU takes them from the head and
+ * idle CPUs steal them from the tail.
+ */
+int schedule_task_balanced(task_t *task) {
+    cpu_t *cpu = ACCESS_ONCE(balanced_cpu);
+
+    ASSERT(task);
+
+    for (unsigned int i = 0; i < get_nr_cpus(); i++) {
+        cpu = get_next_cpu(cpu);
+        if (!cpu || is_task_allowed(task, cpu))
+            break;
+    }
+
+    if (!cpu || !is_task_allowed(task, cpu)) {
+        warning("Unable to schedule task: %s. No CPU in its affinity mask.", task->name);
+        return -EINVAL;
+    }
+
+    ACCESS_ONCE(balanced_cpu) = cpu;
+    task->balanced = true;
+    if (!opt_sched_steal)
+        return schedule_task(task, cpu);
+
     ASSERT(get_task_state(task) == TASK_STATE_READY);
 
-    printk("CPU[%u]: Scheduling task %s[%u] (%s)\n", cpu->id, task->name, task->id,
-           task_repeat_string(task->repeat));
+    dprintk("CPU[%u]: Queueing stealable task %s[%u] (%s)\n", cpu->id, task->name,
+            task->id, task_repeat_string(task->repeat));
+
+    enqueue_task(task, cpu);
+
+    return 0;
+}
+
+/* The owner CPU takes from the head. A thief takes the last task it is allowed
+ * to run.
+ */
+static task_t *take_steal_task(cpu_t *cpu, const cpu_t *thief) {
+    task_t *task = NULL;
+    list_head_t *entry;
+
+    if (list_is_empty(&cpu->steal_queue))
+        return NULL;
 
     spin_lock(&cpu->lock);
-    list_add_tail(&task->list, &cpu->task_queue);
-    task->cpu = cpu;
-    set_task_state(task, TASK_STATE_SCHEDULED);
+    if (!thief) {
+        if (!list_is_empty(&cpu->steal_queue))
+            task = list_first_entry(&cpu->steal_queue, task_t, list);
+    }
+    else {
+        for (entry = cpu->steal_queue.prev; entry != &cpu->steal_queue;
+             entry = entry->prev) {
+            if (is_task_allowed(list_entry(entry, task_t, list), thief)) {
+                task = list_entry(entry, task_t, list);
+                break;
+            }
+        }
+    }
+
+    if (task) {
+        list_unlink(&task->list);
+        cpu->nr_steal_tasks--;
+    }
     spin_unlock(&cpu->lock);
 
+    return task;
+}
+
+/* Move a stealable task onto the CPU's task queue: first from its own steal
+ * queue, otherwise from the most loaded other CPU.
+ */
+static bool fetch_steal_task(cpu_t *cpu) {
+    task_t *task = take_steal_task(cpu, NULL);
+
+    for (unsigned int tries = 0; !task; tries++) {
+        cpu_t *victim = NULL;
+
+        for (cpu_t *c = get_next_cpu(cpu); c && c != cpu; c = get_next_cpu(c)) {
+            if (!victim || ACCESS_ONCE(c->nr_steal_tasks) > victim->nr_steal_tasks)
+                victim = c;
+        }
+
+        if (!victim || ACCESS_ONCE(victim->nr_steal_tasks) == 0)
+            return false;
+
+        /* Give up when the stealable tasks are not allowed to run here */
+        if (tries == get_nr_cpus())
+            return false;
+
+        task = take_steal_task(victim, cpu);
+        if (task) {
+            dprintk("CPU[%u]: Stole task %s[%u] from CPU[%u]\n", cpu->id, task->name,
+                    task->id, victim->id);
+            cpu->nr_stolen++;
+        }
+    }
+
+    move_task(task, cpu);
+    list_add_tail(&task->list, &cpu->task_queue);
+    return true;
+}
+
+/* Nothing to run, but some tasks of the CPU are still held back by their
+ * dependencies.
+ */
+static void wait_for_released_tasks(cpu_t *cpu) {
+    cpu_idle_wait(cpu, !mpsc_is_empty(&cpu->run_queue) ||
+                           ACCESS_ONCE(cpu->nr_steal_tasks) > 0 ||
+                           get_cpu_nr_tasks(cpu, TASK_GROUP_ALL) == 0);
+}
+
+void __noreturn task_main(task_t *task) {
+    interrupts_enable();
+    task->result = task->func(task->arg);
+
+    interrupts_disable();
+    set_task_state(task, TASK_STATE_DONE);
+    context_switch(&task->sp, task->cpu->sched_sp);
+    UNREACHABLE();
+}
+
+/* Preemptible tasks and coroutines run on their own stack, starting in task_main() */
+static bool prepare_task_context(task_t *task) {
+    struct task_frame *frame;
+
+    if (task->type != TASK_TYPE_KERNEL || !(opt_sched_preempt || task->coroutine))
+        return false;
+
+    if (!task->kstack) {
+        task->kstack = get_task_stack(task->cpu);
+        if (!task->kstack)
+            return false;
+    }
+
+    frame = task->kstack + TASK_STACK_SIZE - sizeof(*frame);
+    memset(frame, 0, sizeof(*frame));
+    frame->r12 = _ul(task);
+    frame->ip = _ul(task_trampoline);
+    task->sp = frame;
+
+    return true;
+}
+
+/* Returns when the task is done, yields or its time slice has expired */
+static void switch_to_task(task_t *task) {
+    cpu_t *cpu = task->cpu;
+    unsigned long flags = interrupts_disable_save();
+
+    task->slice_end = get_local_ticks() + opt_sched_quantum;
+    if (opt_sched_preempt && opt_tickless)
+        add_timer(&cpu->slice_timer, rdtsc() + us_to_tsc(opt_sched_quantum * 1000));
+    PERCPU_SET_QWORD(current_task, task);
+    context_switch(&cpu->sched_sp, task->sp);
+    PERCPU_SET_QWORD(current_task, NULL);
+
+    interrupts_restore(flags);
+
+    if (get_task_state(task) == TASK_STATE_DONE) {
+        task->sp = NULL;
+        return;
+    }
+
+    if (task->preempted)
+        cpu->nr_preempted++;
+    set_task_state(task, TASK_STATE_SUSPENDED);
+}
+
+static void resume_task(task_t *task) {
+    if (task->preempted) {
+        task->cpu->nr_preempted--;
+        task->preempted = false;
+    }
+    task->wakeup_ticks = 0;
+    set_task_state(task, TASK_STATE_RUNNING);
+    switch_to_task(task);
+}
+
+/* Called from the local APIC timer interrupt handler */
+void sched_tick(void) {
+    task_t *task = PERCPU_GET(current_task);
+
+    if (!task || !opt_sched_preempt || get_local_ticks() < task->slice_end)
+        return;
+
+    task->preempted = true;
+    context_switch(&task->sp, task->cpu->sched_sp);
+}
+
+/* Give up the CPU to other tasks. Does nothing more than cpu_relax() when not
+ * called from a task running on its own stack.
+ */
+void task_yield(void) {
+    task_t *task = PERCPU_GET(current_task);
+    unsigned long flags;
+
+    if (!task) {
+        cpu_relax();
+        return;
+    }
+
+    flags = interrupts_disable_save();
+    context_switch(&task->sp, task->cpu->sched_sp);
+    interrupts_restore(flags);
+}
+
+static inline bool has_sched_timer(void) {
+    return PERCPU_GET(apic_timer_enabled) || boot_flags.timer_global;
+}
+
+static inline time_t get_sched_ticks(void) {
+    return PERCPU_GET(apic_timer_enabled) ? get_local_ticks() : get_timer_ticks();
+}
+
+static inline bool is_task_sleeping(const task_t *task) {
+    return task->wakeup_ticks && get_sched_ticks() < task->wakeup_ticks;
+}
+
+/* The calling task is not resumed before ms milliseconds have passed. Tasks not
+ * running on their own stack sleep the usual way.
+ */
+int task_sleep_ms(time_t ms) {
+    task_t *task = PERCPU_GET(current_task);
+
+    if (!task)
+        return PERCPU_GET(apic_timer_enabled) ? msleep_local(ms) : msleep(ms);
+
+    if (!has_sched_timer())
+        return -ENODEV;
+
+    task->wakeup_ticks = get_sched_ticks() + ms;
+    task_yield();
+
     return 0;
 }
 
+static inline bool is_task_blocked(const task_t *task) {
+    return task->blocked_on && !ACCESS_ONCE(*task->blocked_on);
+}
+
+/* Park the calling task until *flag is set and task_wake() is called for it.
+ * Tasks not running on their own stack keep polling the flag.
+ */
+void task_block(const volatile bool *flag) {
+    task_t *task = PERCPU_GET(current_task);
+
+    if (!task) {
+        while (!ACCESS_ONCE(*flag))
+            cpu_relax();
+        return;
+    }
+
+    task->blocked_on = flag;
+    task_yield();
+    task->blocked_on = NULL;
+}
+
+/* Called after setting the flag of a blocked task, from any CPU or interrupt */
+void task_wake(task_t *task) {
+    cpu_t *cpu = task->cpu;
+
+    atomic_inc(&cpu->nr_wakeups);
+    wake_cpu(cpu);
+}
+
+/* Every task on the CPU is asleep, so wait for the next timer tick. Without
+ * periodic ticks, wait for the next millisecond.
+ */
+static void wait_for_tick(void) {
+    if (PERCPU_GET(apic_timer_enabled) && opt_tickless)
+        usleep(1000);
+    else if (PERCPU_GET(apic_timer_enabled) && idle_mode != IDLE_MODE_POLL &&
+        interrupts_enabled())
+        hlt();
+    else
+        cpu_relax();
+}
+
 static void run_task(task_t *task) {
+    bool preemptible;
+
     if (!task)
         return;
 
     wait_for_task_state(task, TASK_STATE_SCHEDULED);
 
+    /* Tasks running to completion could spin on locks held by preempted tasks */
+    preemptible = prepare_task_context(task);
+    if (!preemptible && task->cpu->nr_preempted > 0)
+        return;
+
     if (atomic64_inc_return(&task->exec_count) == 0)
-        printk("CPU[%u]: Running task %s[%u]\n", task->cpu->id, task->name, task->id);
+        dprintk("CPU[%u]: Running task %s[%u]\n", task->cpu->id, task->name, task->id);
 
     set_task_state(task, TASK_STATE_RUNNING);
+    if (preemptible) {
+        switch_to_task(task);
+        return;
+    }
+
     if (task->type == TASK_TYPE_USER)
         task->result = enter_usermode(task->func, task->arg, task->stack);
     else
@@ -213,33 +973,49 @@ static void run_task(task_t *task) {
     set_task_state(task, TASK_STATE_DONE);
 }
 
+/* Wait until all tasks of the group scheduled on the CPU are completed
+ * (and destroyed). When group is unspecified the function waits for all tasks.
+ * The task queues themselves are private to the owner CPU, so only the
+ * per-CPU task counters are looked at.
+ */
 void wait_for_task_group(const cpu_t *cpu, task_group_t group) {
-    task_t *task, *safe;
-    bool busy;
+    cpu_wait(&cpu->nr_tasks[group], get_cpu_nr_tasks(cpu, group) == 0);
+}
+
+/* Busy and idle time of each CPU within its last run_tasks() window, and the run
+ * and queueing times of the task executions it completed there.
+ */
+void print_sched_stats(void) {
+    cpu_t *first_cpu = get_next_cpu(NULL), *cpu = first_cpu;
 
     do {
-        busy = false;
+        uint64_t total = cpu->sched_end_tsc - cpu->sched_start_tsc;
+        uint64_t busy = min(cpu->busy_cycles, total);
 
-        list_for_each_entry_safe (task, safe, &cpu->task_queue, list) {
-            /* When group is unspecified the functions waits for all tasks. */
-            if (group != TASK_GROUP_ALL && task->gid != group)
-                continue;
+        if (cpu->sched_end_tsc > cpu->sched_start_tsc) {
+            printk("CPU[%u]: Ran %u tasks (%u stolen), busy %lu cycles, idle %lu cycles "
+                   "(%lu%%)\n",
+                   cpu->id, cpu->nr_executed, cpu->nr_stolen, busy, total - busy,
+                   busy * 100 / total);
+        }
 
-            if (get_task_state(task) != TASK_STATE_DONE) {
-                busy = true;
-                wait_for_task_state(task, TASK_STATE_DONE);
-            }
+        if (cpu->nr_executed > 0) {
+            printk("CPU[%u]: Task cycles: run min/avg/max %lu/%lu/%lu, wait avg %lu\n",
+                   cpu->id, cpu->run_min, cpu->run_total / cpu->nr_executed,
+                   cpu->run_max, cpu->wait_cycles / cpu->nr_executed);
         }
-        cpu_relax();
-    } while (busy);
+
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first_cpu);
 }
 
 void process_task_repeat(task_t *task) {
     switch (task->repeat) {
     case TASK_REPEAT_ONCE:
-        printk("%s task '%s' finished on CPU[%u] with result %ld (Run: %lu times)\n",
-               task->type == TASK_TYPE_KERNEL ? "Kernel" : "User", task->name,
-               task->cpu->id, task->result, atomic_read(&task->exec_count));
+        dprintk("%s task '%s' finished on CPU[%u] with result %ld (Run: %lu times)\n",
+                task->type == TASK_TYPE_KERNEL ? "Kernel" : "User", task->name,
+                task->cpu->id, task->result, atomic_read(&task->exec_count));
+        release_dependents(task);
         destroy_task(task);
         break;
     case TASK_REPEAT_LOOP:
@@ -254,13 +1030,38 @@ void process_task_repeat(task_t *task) {
 
 void run_tasks(cpu_t *cpu) {
     task_t *task, *safe;
+    bool asleep, sleeping;
+    int wakeups;
 
     if (!is_cpu_bsp(cpu))
         wait_cpu_unblocked(cpu);
     set_cpu_unfinished(cpu);
 
+    cpu->busy_cycles = 0;
+    cpu->wait_cycles = 0;
+    cpu->run_min = 0;
+    cpu->run_max = 0;
+    cpu->run_total = 0;
+    cpu->nr_executed = 0;
+    cpu->nr_stolen = 0;
+    cpu->sched_start_tsc = rdtsc();
+
     do {
+        dequeue_new_tasks(cpu);
+        reap_dead_tasks(cpu);
+
+        wakeups = atomic_read(&cpu->nr_wakeups);
+        asleep = !list_is_empty(&cpu->task_queue);
+        sleeping = false;
         list_for_each_entry_safe (task, safe, &cpu->task_queue, list) {
+            if (task->state == TASK_STATE_SUSPENDED && is_task_sleeping(task)) {
+                sleeping = true;
+                continue;
+            }
+            if (task->state == TASK_STATE_SUSPENDED && is_task_blocked(task))
+                continue;
+
+            asleep = false;
             switch (task->state) {
             case TASK_STATE_DONE:
                 process_task_repeat(task);
@@ -268,12 +1069,28 @@ void run_tasks(cpu_t *cpu) {
             case TASK_STATE_SCHEDULED:
                 run_task(task);
                 break;
+            case TASK_STATE_SUSPENDED:
+                resume_task(task);
+                break;
             default:
                 BUG();
             }
             cpu_relax();
         }
-    } while (!list_is_empty(&cpu->task_queue));
+
+        if (asleep && sleeping)
+            wait_for_tick();
+        else if (asleep)
+            cpu_idle_wait(cpu, atomic_read(&cpu->nr_wakeups) != wakeups ||
+                                   !mpsc_is_empty(&cpu->run_queue));
+        else if (list_is_empty(&cpu->task_queue) && !fetch_steal_task(cpu))
+            wait_for_released_tasks(cpu);
+    } while (get_cpu_nr_tasks(cpu, TASK_GROUP_ALL) > 0);
+    reap_dead_tasks(cpu);
+    cpu->sched_end_tsc = rdtsc();
+
+    if (is_cpu_bsp(cpu))
+        ACCESS_ONCE(balanced_cpu) = NULL;
 
     if (!is_cpu_bsp(cpu))
         set_cpu_blocked(cpu);
@@ -28,6 +28,7 @@
 #include <console.h>
 #include <cpu.h>
 #include <cpuid.h>
+#include <idle.h>
 #include <drivers/keyboard.h>
 #include <ioapic.h>
 #include <ktf.h>
@@ -42,7 +43,9 @@
 #include <segment.h>
 #include <setup.h>
 #include <string.h>
+#include <trace.h>
 #include <traps.h>
+#include <tsc.h>
 
 #include <mm/pmm.h>
 #include <mm/regions.h>
@@ -159,6 +162,11 @@ static void __text_init init_vga_console(void) {
 
 void __text_init init_timers(cpu_t *cpu) {
     if (is_cpu_bsp(cpu)) {
+        if (opt_tickless && !opt_apic_timer) {
+            warning("Tickless timers require the local APIC timer (apic_timer)");
+            opt_tickless = false;
+        }
+
         if (opt_hpet)
             boot_flags.timer_global = init_hpet(cpu);
 
@@ -211,6 +219,9 @@ void __noreturn __text_init kernel_start(uint32_t multiboot_magic, unsigned long
     init_regions();
     init_pmm();
 
+    /* Program PAT memory types before any cache type specific mapping */
+    init_pat();
+
     /* Setup final pagetables */
     init_pagetables();
     boot_flags.virt = true;
@@ -241,6 +252,8 @@ void __noreturn __text_init kernel_start(uint32_t multiboot_magic, unsigned long
 
     init_tasks();
 
+    init_idle();
+
     /* Try to initialize ACPI (and MADT) */
 #ifndef KTF_ACPICA
     if (init_acpi() < 0) {
@@ -258,9 +271,19 @@ void __noreturn __text_init kernel_start(uint32_t multiboot_magic, unsigned long
     init_timers(bsp);
     interrupts_enable();
 
+    init_tsc();
+
     if (!boot_flags.nosmp)
         init_smp();
 
+    init_cpu_topology();
+
+    if (opt_printk_async)
+        init_printk_async();
+
+    if (opt_trace_size > 0)
+        init_trace();
+
     init_pci();
 
     /* Initialize console input */
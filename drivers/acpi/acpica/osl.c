@@ -408,7 +408,7 @@ ACPI_STATUS AcpiOsCreateLock(ACPI_SPINLOCK *OutHandle) {
     if (!lock)
         return AE_NO_MEMORY;
 
-    *lock = SPINLOCK_INIT;
+    spin_lock_init(lock);
     *OutHandle = lock;
 
     return AE_OK;
@@ -417,6 +417,7 @@ ACPI_STATUS AcpiOsCreateLock(ACPI_SPINLOCK *OutHandle) {
 void AcpiOsDeleteLock(ACPI_SPINLOCK Handle) {
     spinlock_t *lock = Handle;
 
+    spin_lock_destroy(lock);
     kfree((void *) lock);
 }
 
@@ -456,6 +457,7 @@ ACPI_STATUS AcpiOsDeleteSemaphore(ACPI_SEMAPHORE Handle) {
     if (!sem)
         return AE_BAD_PARAMETER;
 
+    sem_destroy(sem);
     kfree((void *) sem);
     return AE_OK;
 }
@@ -464,14 +466,16 @@ ACPI_STATUS AcpiOsWaitSemaphore(ACPI_SEMAPHORE Handle, UINT32 Units, UINT16 Time
     if (!Handle)
         return AE_BAD_PARAMETER;
 
-    if (Timeout == ACPI_DO_NOT_WAIT) {
-        uint32_t val = sem_value(Handle);
+    if (Timeout == ACPI_DO_NOT_WAIT)
+        return sem_trywait_units(Handle, Units) ? AE_OK : AE_TIME;
 
-        if (val < Units)
-            return AE_TIME;
+    if (Timeout == ACPI_WAIT_FOREVER) {
+        sem_wait_units(Handle, Units);
+        return AE_OK;
     }
 
-    sem_wait_units(Handle, Units);
+    if (sem_wait_units_timeout(Handle, Units, (uint64_t) Timeout * 1000) < 0)
+        return AE_TIME;
 
     return AE_OK;
 }
@@ -23,11 +23,13 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <apic.h>
+#include <cmdline.h>
 #include <errno.h>
 #include <ioapic.h>
 #include <ktf.h>
 #include <lib.h>
 #include <setup.h>
+#include <spinlock.h>
 
 #include <drivers/serial.h>
 
@@ -40,6 +42,22 @@ static struct {
 
 io_port_t __data_rmode com_ports[4];
 
+#define UART_TX_BUF_SIZE PAGE_SIZE
+
+/* Transmit ring of an initialized port. Once its IRQ is routed, the ring is drained
+ * by the THR empty interrupt in FIFO sized bursts, so writers do not wait on the line.
+ */
+static struct uart_tx {
+    io_port_t port;
+    spinlock_t lock;
+    unsigned int fifo_size;
+    ier_t ier;
+    bool irq;    /* Writes go through the ring */
+    bool active; /* THR empty interrupt enabled */
+    unsigned int head, tail;
+    char buf[UART_TX_BUF_SIZE];
+} uart_tx[MAX_COM];
+
 static inline const char *com_name(com_idx_t com) {
     switch (com) {
     case COM1:
@@ -140,9 +158,11 @@ static inline int uart_port_ready(io_port_t port) {
 }
 
 int __text_init init_uart(com_idx_t com, const uart_config_t *cfg) {
+    struct uart_tx *tx = &uart_tx[com];
     mcr_t mcr = {0};
     fcr_t fcr = {0};
     ier_t ier = {0};
+    iir_t iir;
 
     /* Enable interrupts for received data available */
     ier.rx_avl = 1;
@@ -160,6 +180,16 @@ int __text_init init_uart(com_idx_t com, const uart_config_t *cfg) {
     fcr.int_lvl = FIFO_INT_TRIGGER_LEVEL_1;
     outb(cfg->port + UART_FCR_REG_OFFSET, fcr.reg);
 
+    /* 16550A and later have a 16 byte transmit FIFO, the older ones a single THR */
+    iir.reg = inb(cfg->port + UART_IIR_REG_OFFSET);
+    tx->fifo_size = iir.fifo_status == UART_IIR_FIFO_ENABLED ? UART_TX_FIFO_SIZE : 1;
+
+    tx->port = cfg->port;
+    tx->ier = ier;
+    tx->irq = tx->active = false;
+    tx->head = tx->tail = 0;
+    spin_lock_init(&tx->lock);
+
     /* Set tx/rx ready state */
     mcr.dtr = 1;
     mcr.rts = 1;
@@ -180,6 +210,22 @@ void __text_init init_uart_input(const cpu_t *cpu) {
 
     configure_isa_irq(COM1_IRQ, COM1_IRQ_OFFSET, IOAPIC_DEST_MODE_PHYSICAL, cpu->id);
     configure_isa_irq(COM2_IRQ, COM2_IRQ_OFFSET, IOAPIC_DEST_MODE_PHYSICAL, cpu->id);
+
+    if (!opt_serial_tx_irq)
+        return;
+
+    /* COM3 and COM4 share the IRQ lines of COM1 and COM2 */
+    for (unsigned int i = 0; i < ARRAY_SIZE(uart_tx); i++) {
+        struct uart_tx *tx = &uart_tx[i];
+        unsigned long flags;
+
+        if (tx->port == NO_COM_PORT)
+            continue;
+
+        flags = spin_lock_irqsave(&tx->lock);
+        tx->irq = true;
+        spin_unlock_irqrestore(&tx->lock, flags);
+    }
 }
 
 static inline int uart_port_status(io_port_t port) {
@@ -194,45 +240,147 @@ static inline int uart_port_status(io_port_t port) {
     return 0;
 }
 
-static int uart_putc(io_port_t port, char c) {
-    int rc = uart_port_status(port);
+static inline struct uart_tx *get_uart_tx(io_port_t port) {
+    for (unsigned int i = 0; i < ARRAY_SIZE(uart_tx); i++) {
+        if (uart_tx[i].port == port)
+            return &uart_tx[i];
+    }
 
-    if (rc == 0)
-        putc(c, port + UART_TXD_REG_OFFSET);
+    return NULL;
+}
 
-    return rc;
+static inline unsigned int uart_fifo_size(io_port_t port) {
+    struct uart_tx *tx = get_uart_tx(port);
+
+    return tx ? tx->fifo_size : 1;
+}
+
+static inline unsigned int uart_tx_count(const struct uart_tx *tx) {
+    return tx->head - tx->tail;
 }
 
-static int uart_puts(io_port_t port, const char *buf, size_t len) {
-    int rc = uart_port_status(port);
+static inline unsigned int uart_tx_space(const struct uart_tx *tx) {
+    return UART_TX_BUF_SIZE - uart_tx_count(tx);
+}
 
-    if (rc == 0)
-        puts(port + UART_TXD_REG_OFFSET, buf, len);
+static inline void uart_tx_set_active(struct uart_tx *tx, bool active) {
+    tx->active = active;
+    tx->ier.thr_empty = active;
+    outb(tx->port + UART_IER_REG_OFFSET, tx->ier.reg);
+}
 
-    return rc;
+/* Move up to a FIFO worth of bytes from the ring to the (empty) THR */
+static void uart_tx_burst(struct uart_tx *tx) {
+    unsigned int n = min(uart_tx_count(tx), tx->fifo_size);
+
+    while (n--)
+        putc(tx->buf[tx->tail++ % UART_TX_BUF_SIZE], tx->port + UART_TXD_REG_OFFSET);
 }
 
 #define SERIAL_TIMEOUT 1000 /* ~1s */
-int serial_putchar(io_port_t port, char c) {
+static int uart_wait_thr_empty(io_port_t port) {
     unsigned retries = SERIAL_TIMEOUT;
     int rc;
 
     do {
-        rc = uart_putc(port, c);
+        rc = uart_port_status(port);
     } while (rc == -EAGAIN && retries--);
 
     return rc;
 }
 
+/* Drain the ring by polling, until at least space bytes are free */
+static int uart_tx_drain(struct uart_tx *tx, unsigned int space) {
+    while (uart_tx_space(tx) < space) {
+        int rc = uart_wait_thr_empty(tx->port);
+
+        if (rc < 0)
+            return rc;
+        uart_tx_burst(tx);
+    }
+
+    return 0;
+}
+
+static int uart_tx_write(struct uart_tx *tx, const char *buf, size_t len) {
+    unsigned long flags;
+    int rc = 0;
+
+    flags = spin_lock_irqsave(&tx->lock);
+    if (!tx->irq) {
+        spin_unlock_irqrestore(&tx->lock, flags);
+        return -EAGAIN;
+    }
+
+    while (len > 0) {
+        size_t n = min(len, (size_t) UART_TX_BUF_SIZE);
+
+        /* Ring full: fall back to writing out its content synchronously */
+        rc = uart_tx_drain(tx, n);
+        if (rc < 0)
+            break;
+
+        for (size_t i = 0; i < n; i++)
+            tx->buf[tx->head++ % UART_TX_BUF_SIZE] = buf[i];
+        buf += n;
+        len -= n;
+    }
+
+    /* The THR empty interrupt fires right away, when enabled on an empty THR */
+    if (!tx->active && uart_tx_count(tx) > 0)
+        uart_tx_set_active(tx, true);
+    spin_unlock_irqrestore(&tx->lock, flags);
+
+    return rc;
+}
+
+/* Write out the rings and go back to polled transmission, e.g. on panic() */
+void serial_sync(void) {
+    for (unsigned int i = 0; i < ARRAY_SIZE(uart_tx); i++) {
+        struct uart_tx *tx = &uart_tx[i];
+        unsigned long flags;
+
+        if (!tx->irq)
+            continue;
+
+        flags = spin_lock_irqsave(&tx->lock);
+        tx->irq = false;
+        if (tx->active)
+            uart_tx_set_active(tx, false);
+        uart_tx_drain(tx, UART_TX_BUF_SIZE);
+        spin_unlock_irqrestore(&tx->lock, flags);
+    }
+}
+
+int serial_putchar(io_port_t port, char c) {
+    return serial_write(port, &c, 1);
+}
+
 int serial_write(io_port_t port, const char *buf, size_t len) {
-    unsigned retries = SERIAL_TIMEOUT;
+    struct uart_tx *tx = get_uart_tx(port);
+    unsigned int fifo_size;
     int rc;
 
-    do {
-        rc = uart_puts(port, buf, len);
-    } while (rc == -EAGAIN && retries--);
+    if (tx) {
+        rc = uart_tx_write(tx, buf, len);
+        if (rc != -EAGAIN)
+            return rc;
+    }
 
-    return rc;
+    fifo_size = uart_fifo_size(port);
+    while (len > 0) {
+        size_t n = min(len, (size_t) fifo_size);
+
+        rc = uart_wait_thr_empty(port);
+        if (rc < 0)
+            return rc;
+
+        puts(port + UART_TXD_REG_OFFSET, buf, n);
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
 }
 
 #define NUM_PLUS 3
@@ -248,24 +396,65 @@ static inline void uart_reboot(char c) {
         reboot();
 }
 
+static void uart_tx_interrupt(struct uart_tx *tx) {
+    spin_lock(&tx->lock);
+    if (!tx->active) {
+        spin_unlock(&tx->lock);
+        return;
+    }
+
+    /* Without a receiver, wait for the modem status change interrupt */
+    if (uart_tx_count(tx) == 0 || !receiver_ready(tx->port))
+        uart_tx_set_active(tx, false);
+    else
+        uart_tx_burst(tx);
+    spin_unlock(&tx->lock);
+}
+
+static void uart_msr_interrupt(struct uart_tx *tx) {
+    /* Reading the MSR acknowledges the interrupt */
+    if (!receiver_ready(tx->port))
+        return;
+
+    spin_lock(&tx->lock);
+    if (tx->irq && !tx->active && uart_tx_count(tx) > 0)
+        uart_tx_set_active(tx, true);
+    spin_unlock(&tx->lock);
+}
+
 void uart_interrupt_handler(void) {
     for (unsigned int i = 0; i < ARRAY_SIZE(com_ports); ++i) {
         com_port_t com_port = com_ports[i];
+        struct uart_tx *tx;
         iir_t iir;
 
         if (com_port == NO_COM_PORT)
             continue;
-
-        iir.reg = inb(com_port + UART_IIR_REG_OFFSET);
-        if (iir.event == UART_IIR_EVENT_RXD_AVAIL ||
-            iir.event == UART_IIR_EVENT_CHAR_TIMEOUT) {
-            uint8_t input = inb(com_ports[i] + UART_RBR_REG_OFFSET);
-
-            input_state.buf[input_state.curr] = input;
-            input_state.curr = (input_state.curr + 1) % sizeof(input_state.buf);
-
-            printk("%c", input);
-            uart_reboot(input);
+        tx = get_uart_tx(com_port);
+
+        for (iir.reg = inb(com_port + UART_IIR_REG_OFFSET); !iir.no_int_pend;
+             iir.reg = inb(com_port + UART_IIR_REG_OFFSET)) {
+            if (iir.event == UART_IIR_EVENT_RXD_AVAIL ||
+                iir.event == UART_IIR_EVENT_CHAR_TIMEOUT) {
+                uint8_t input = inb(com_ports[i] + UART_RBR_REG_OFFSET);
+
+                input_state.buf[input_state.curr] = input;
+                input_state.curr = (input_state.curr + 1) % sizeof(input_state.buf);
+
+                printk("%c", input);
+                uart_reboot(input);
+            }
+            else if (iir.event == UART_IIR_EVENT_THR_EMPTY && tx) {
+                uart_tx_interrupt(tx);
+            }
+            else if (iir.event == UART_IIR_EVENT_MSR_CHANGE && tx) {
+                uart_msr_interrupt(tx);
+            }
+            else {
+                /* Acknowledge line status and unowned modem status changes */
+                inb(com_port + UART_LSR_REG_OFFSET);
+                inb(com_port + UART_MSR_REG_OFFSET);
+            }
         }
     }
 
@@ -29,11 +29,18 @@
 #include <ktf.h>
 #include <lib.h>
 #include <page.h>
+#include <string.h>
 
 #define APIC_IRQ_BASE         PIC_IRQ_END_OFFSET
 #define APIC_TIMER_IRQ_OFFSET (APIC_IRQ_BASE + 0x00)
 #define APIC_TIMER_IRQ_VECTOR APIC_TIMER_IRQ_OFFSET
 
+#define APIC_WAKEUP_IRQ_OFFSET (APIC_IRQ_BASE + 0x01)
+#define APIC_WAKEUP_IRQ_VECTOR APIC_WAKEUP_IRQ_OFFSET
+
+#define APIC_QUIET_IRQ_OFFSET (APIC_IRQ_BASE + 0x02)
+#define APIC_QUIET_IRQ_VECTOR APIC_QUIET_IRQ_OFFSET
+
 #define MSR_X2APIC_REGS 0x800U
 
 #ifndef __ASSEMBLY__
@@ -218,7 +225,7 @@ typedef enum apic_lvt_deliv_mode apic_lvt_deliv_mode_t;
 enum apic_lvt_timer_mode {
     APIC_LVT_TIMER_ONE_SHOT = 0x00,
     APIC_LVT_TIMER_PERIODIC = 0x01,
-    APIC_LVT_TIMER_TSC_DEADLINE = 0x10,
+    APIC_LVT_TIMER_TSC_DEADLINE = 0x02,
 };
 typedef enum apic_lvt_timer_mode apic_lvt_timer_mode_t;
 
@@ -463,6 +470,7 @@ extern apic_icr_t apic_icr_read(void);
 extern void apic_icr_write(const apic_icr_t *icr);
 
 extern void init_apic_timer(void);
+extern void apic_timer_set_deadline(uint64_t deadline);
 
 /* Static declarations */
 
@@ -506,6 +514,19 @@ static inline void apic_icr_set_dest(apic_icr_t *icr, uint32_t dest) {
         icr->x2apic_dest = dest;
 }
 
+static inline void apic_send_ipi(uint32_t dest, uint8_t vector) {
+    apic_icr_t icr;
+
+    memset(&icr, 0, sizeof(icr));
+    apic_icr_set_dest(&icr, dest);
+    icr.deliv_mode = APIC_DELIV_MODE_FIXED;
+    icr.level = APIC_ICR_LEVEL_ASSERT;
+    icr.vector = vector;
+
+    apic_wait_ready();
+    apic_icr_write(&icr);
+}
+
 static inline void apic_EOI(void) {
     apic_write(APIC_EOI, APIC_EOI_SIGNAL);
 }
@@ -36,9 +36,81 @@ typedef struct {
     int64_t counter;
 } atomic64_t;
 
+/* Operand of cmpxchg16b, which requires 16 byte alignment */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} __aligned(16) atomic128_t;
+
+#define CPUID_FEATURE_CX16 (_U32(1) << 13)
+
 #define atomic_set(v, i) (ACCESS_ONCE((v)->counter) = (i))
 #define atomic_read(v)   (ACCESS_ONCE((v)->counter))
 
+/* x86 (TSO) only reorders later loads before earlier stores. Plain loads have acquire
+ * and plain stores have release semantics, so only the compiler needs to be held back.
+ * Sequentially consistent stores use xchg.
+ */
+#define load_relaxed(ptr) ACCESS_ONCE(*(ptr))
+#define load_acquire(ptr)                                                                \
+    ({                                                                                   \
+        typeof(*(ptr)) __load_val = ACCESS_ONCE(*(ptr));                                 \
+        barrier();                                                                       \
+        __load_val;                                                                      \
+    })
+
+#define store_relaxed(ptr, v) (ACCESS_ONCE(*(ptr)) = (v))
+#define store_release(ptr, v)                                                            \
+    do {                                                                                 \
+        barrier();                                                                       \
+        ACCESS_ONCE(*(ptr)) = (v);                                                       \
+    } while (0)
+#define store_seq_cst(ptr, v) ((void) xchg((ptr), (v)))
+
+#define atomic_read_acquire(v)   load_acquire(&(v)->counter)
+#define atomic_set_release(v, i) store_release(&(v)->counter, (i))
+
+/* Atomically exchange *ptr with v and return the old value (xchg implies lock) */
+#define xchg(ptr, v)                                                                     \
+    ({                                                                                   \
+        typeof(*(ptr)) __xchg_val = (v);                                                 \
+        asm volatile("xchg %[val], %[addr]"                                              \
+                     : [ val ] "+r"(__xchg_val), [ addr ] "+m"(*(ptr))                   \
+                     :                                                                   \
+                     : "memory");                                                        \
+        __xchg_val;                                                                      \
+    })
+
+/* Atomically replace *ptr with v, if it equals old. Returns the previous value */
+#define cmpxchg(ptr, old, v)                                                             \
+    ({                                                                                   \
+        typeof(*(ptr)) __cmpxchg_prev = (old);                                           \
+        asm volatile("lock cmpxchg %[val], %[addr]"                                      \
+                     : "+a"(__cmpxchg_prev), [ addr ] "+m"(*(ptr))                       \
+                     : [ val ] "r"((typeof(*(ptr))) (v))                                 \
+                     : "cc", "memory");                                                  \
+        __cmpxchg_prev;                                                                  \
+    })
+
+/* Like cmpxchg(), but returns success and updates *old with the value found */
+#define try_cmpxchg(ptr, old, v)                                                         \
+    ({                                                                                   \
+        typeof(*(ptr)) __try_old = *(old);                                               \
+        typeof(*(ptr)) __try_prev = cmpxchg((ptr), __try_old, (v));                      \
+        *(old) = __try_prev;                                                             \
+        __try_prev == __try_old;                                                         \
+    })
+
+/* Every locked instruction is a full barrier on x86. The ordering variants exist for
+ * code written against the usual memory model, they all map to the same instruction.
+ */
+#define xchg_relaxed(ptr, v)         xchg(ptr, v)
+#define xchg_acquire(ptr, v)         xchg(ptr, v)
+#define xchg_release(ptr, v)         xchg(ptr, v)
+#define cmpxchg_relaxed(ptr, old, v) cmpxchg(ptr, old, v)
+#define cmpxchg_acquire(ptr, old, v) cmpxchg(ptr, old, v)
+#define cmpxchg_release(ptr, old, v) cmpxchg(ptr, old, v)
+
 /* Static declarations */
 
 static inline bool atomic_test_bit(unsigned int bit, volatile void *addr) {
@@ -183,6 +255,129 @@ static inline int atomic64_dec_and_test(atomic64_t *v) {
     return c != 0;
 }
 
+static inline int32_t atomic_xchg(atomic_t *v, int32_t n) {
+    return xchg(&v->counter, n);
+}
+
+static inline int64_t atomic64_xchg(atomic64_t *v, int64_t n) {
+    return xchg(&v->counter, n);
+}
+
+/* Returns the previous value, the swap took place if it equals old */
+static inline int32_t atomic_cmpxchg(atomic_t *v, int32_t old, int32_t n) {
+    return cmpxchg(&v->counter, old, n);
+}
+
+static inline int64_t atomic64_cmpxchg(atomic64_t *v, int64_t old, int64_t n) {
+    return cmpxchg(&v->counter, old, n);
+}
+
+static inline bool atomic_try_cmpxchg(atomic_t *v, int32_t *old, int32_t n) {
+    return try_cmpxchg(&v->counter, old, n);
+}
+
+static inline bool atomic64_try_cmpxchg(atomic64_t *v, int64_t *old, int64_t n) {
+    return try_cmpxchg(&v->counter, old, n);
+}
+
+/* Fetch-ops return the value before the operation */
+static inline int32_t atomic_fetch_add(atomic_t *v, int32_t n) {
+    return atomic_add_return(v, n);
+}
+
+static inline int64_t atomic64_fetch_add(atomic64_t *v, int64_t n) {
+    return atomic64_add_return(v, n);
+}
+
+static inline int32_t atomic_fetch_sub(atomic_t *v, int32_t n) {
+    return atomic_add_return(v, -n);
+}
+
+static inline int64_t atomic64_fetch_sub(atomic64_t *v, int64_t n) {
+    return atomic64_add_return(v, -n);
+}
+
+/* There is no fetching form of lock or/and/xor, hence the cmpxchg loops */
+#define ATOMIC_FETCH_OP(op, c_op)                                                        \
+    static inline int32_t atomic_fetch_##op(atomic_t *v, int32_t n) {                    \
+        int32_t old = atomic_read(v);                                                    \
+        while (!atomic_try_cmpxchg(v, &old, old c_op n))                                 \
+            ;                                                                            \
+        return old;                                                                      \
+    }                                                                                    \
+    static inline int64_t atomic64_fetch_##op(atomic64_t *v, int64_t n) {                \
+        int64_t old = atomic_read(v);                                                    \
+        while (!atomic64_try_cmpxchg(v, &old, old c_op n))                               \
+            ;                                                                            \
+        return old;                                                                      \
+    }
+
+ATOMIC_FETCH_OP(or, |)
+ATOMIC_FETCH_OP(and, &)
+ATOMIC_FETCH_OP(xor, ^)
+#undef ATOMIC_FETCH_OP
+
+#define ATOMIC_OP(op, insn)                                                              \
+    static inline void atomic_##op(atomic_t *v, int32_t n) {                             \
+        asm volatile("lock " insn "l %[n], %[addr]"                                      \
+                     : [ addr ] "+m"(v->counter)                                         \
+                     : [ n ] "ir"(n)                                                     \
+                     : "cc", "memory");                                                  \
+    }                                                                                    \
+    static inline void atomic64_##op(atomic64_t *v, int64_t n) {                         \
+        asm volatile("lock " insn "q %[n], %[addr]"                                      \
+                     : [ addr ] "+m"(v->counter)                                         \
+                     : [ n ] "er"(n)                                                     \
+                     : "cc", "memory");                                                  \
+    }
+
+ATOMIC_OP(add, "add")
+ATOMIC_OP(sub, "sub")
+ATOMIC_OP(or, "or")
+ATOMIC_OP(and, "and")
+ATOMIC_OP(xor, "xor")
+#undef ATOMIC_OP
+
+#define atomic_fetch_add_relaxed(v, n)  atomic_fetch_add(v, n)
+#define atomic_fetch_add_acquire(v, n)  atomic_fetch_add(v, n)
+#define atomic_fetch_add_release(v, n)  atomic_fetch_add(v, n)
+#define atomic_fetch_or_relaxed(v, n)   atomic_fetch_or(v, n)
+#define atomic_fetch_or_acquire(v, n)   atomic_fetch_or(v, n)
+#define atomic_fetch_or_release(v, n)   atomic_fetch_or(v, n)
+#define atomic_fetch_and_relaxed(v, n)  atomic_fetch_and(v, n)
+#define atomic_fetch_and_acquire(v, n)  atomic_fetch_and(v, n)
+#define atomic_fetch_and_release(v, n)  atomic_fetch_and(v, n)
+#define atomic_cmpxchg_relaxed(v, o, n) atomic_cmpxchg(v, o, n)
+#define atomic_cmpxchg_acquire(v, o, n) atomic_cmpxchg(v, o, n)
+#define atomic_cmpxchg_release(v, o, n) atomic_cmpxchg(v, o, n)
+
+static inline bool cpu_has_cmpxchg16b(void) {
+    return !!(cpuid_ecx(0x1) & CPUID_FEATURE_CX16);
+}
+
+/* 128-bit compare-and-swap. Returns success, on failure *old gets the value found.
+ * Needs cpu_has_cmpxchg16b().
+ */
+static inline bool atomic128_try_cmpxchg(atomic128_t *v, atomic128_t *old,
+                                         atomic128_t n) {
+    bool ok;
+
+    asm volatile("lock cmpxchg16b %[addr]"
+                 : "=@ccz"(ok), [ addr ] "+m"(*v), "+a"(old->lo), "+d"(old->hi)
+                 : "b"(n.lo), "c"(n.hi)
+                 : "memory");
+
+    return ok;
+}
+
+/* A 16 byte load is only atomic through cmpxchg16b (writing back the same value) */
+static inline atomic128_t atomic128_read(atomic128_t *v) {
+    atomic128_t val = {0, 0};
+
+    atomic128_try_cmpxchg(v, &val, val);
+    return val;
+}
+
 /* External declarations */
 
 #endif /* KTF_ATOMIC_H */
@@ -32,7 +32,22 @@
 #define CPUID_BRAND_INFO_MIN 0x80000002U
 #define CPUID_BRAND_INFO_MAX 0x80000004U
 
+/* Extended topology enumeration */
+#define CPUID_TOPOLOGY_LEAF    0x0BU
+#define CPUID_TOPOLOGY_V2_LEAF 0x1FU
+
+#define CPUID_TOPOLOGY_LEVEL_INVALID 0
+#define CPUID_TOPOLOGY_LEVEL_SMT     1
+
+/* APIC ID bits to shift right to get the core and the package ID */
+struct cpuid_topology {
+    unsigned int smt_shift;
+    unsigned int package_shift;
+};
+typedef struct cpuid_topology cpuid_topology_t;
+
 extern uint64_t get_cpu_freq(const char *cpu_str);
 extern bool cpu_vendor_string(char *cpu_str);
+extern bool cpuid_get_topology(cpuid_topology_t *topo);
 
 #endif /* KTF_CPUID_H */
\ No newline at end of file
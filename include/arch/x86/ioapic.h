@@ -89,6 +89,7 @@ struct ioapic {
     void *virt_address;
     uint32_t gsi_base;
     unsigned nr_entries;
+    uint64_t quiesced[4]; /* Lines masked by ioapic_quiesce() */
 };
 typedef struct ioapic ioapic_t;
 
@@ -216,6 +217,8 @@ extern int get_ioapic_redirtbl_entry(ioapic_t *ioapic, unsigned n,
 extern int set_ioapic_redirtbl_entry(ioapic_t *ioapic, unsigned n,
                                      ioapic_redirtbl_entry_t *entry);
 extern void set_ioapic_irq_mask(ioapic_t *ioapic, unsigned irq, ioapic_int_mask_t mask);
+extern unsigned ioapic_quiesce(const uint32_t *keep_gsis, unsigned nr_keep);
+extern void ioapic_unquiesce(void);
 extern void configure_isa_irq(unsigned irq_src, uint8_t vector,
                               ioapic_dest_mode_t dst_mode, uint8_t dst_ids);
 
@@ -62,6 +62,8 @@
 #define _PAGE_PSE_PAT  0x1000
 #define _PAGE_NX       (_U64(1) << 63)
 
+#define _PAGE_CACHE_MASK (_PAGE_PWT | _PAGE_PCD | _PAGE_PAT)
+
 #define _PAGE_ALL_FLAGS                                                                  \
     (_PAGE_PRESENT | _PAGE_RW | _PAGE_USER | _PAGE_PWT | _PAGE_PCD | _PAGE_AD |          \
      _PAGE_PAT | _PAGE_GLOBAL | _PAGE_PSE_PAT | _PAGE_NX)
@@ -198,6 +200,8 @@ typedef unsigned long mfn_t;
 
 extern void pat_set_type(pat_field_t field, pat_memory_type_t type);
 extern pat_memory_type_t pat_get_type(pat_field_t field);
+extern void init_pat(void);
+extern unsigned long pat_cache_flags(pat_memory_type_t type);
 
 /* Static declarations */
 
@@ -184,6 +184,8 @@ extern int vunmap_user(void *va, mfn_t *mfn, unsigned int *order);
 
 extern int vmap_range(paddr_t paddr, size_t size, unsigned long flags,
                       vmap_flags_t vmap_flags);
+extern int vmap_range_cached(paddr_t paddr, size_t size, unsigned long flags,
+                             pat_memory_type_t type, vmap_flags_t vmap_flags);
 extern int vunmap_range(paddr_t paddr, size_t size, vmap_flags_t vmap_flags);
 
 /* Static declarations */
@@ -360,6 +362,12 @@ static inline void *vmap_kern_4k(void *va, mfn_t mfn, unsigned long l1_flags) {
     return vmap_4k(&cr3, va, mfn, l1_flags, false);
 }
 
+static inline void *vmap_kern_4k_cached(void *va, mfn_t mfn, unsigned long l1_flags,
+                                        pat_memory_type_t type) {
+    l1_flags = (l1_flags & ~_PAGE_CACHE_MASK) | pat_cache_flags(type);
+    return vmap_kern_4k(va, mfn, l1_flags);
+}
+
 static inline void *vmap_user(void *va, mfn_t mfn, unsigned int order,
 #if defined(__x86_64__)
                               unsigned long l4_flags,
@@ -139,6 +139,8 @@
 
 #define MSR_TSC_AUX 0xc0000103
 
+#define MSR_TSC_DEADLINE 0x000006e0
+
 /*
  * Exception mnemonics.
  */
@@ -47,6 +47,8 @@
 #define KB_PORT1_IRQ    KEYBOARD_PORT1_IRQ_VECTOR
 #define KB_PORT2_IRQ    KEYBOARD_PORT2_IRQ_VECTOR
 #define APIC_TIMER_IRQ  APIC_TIMER_IRQ_VECTOR
+#define WAKEUP_IRQ      APIC_WAKEUP_IRQ_VECTOR
+#define QUIET_IRQ       APIC_QUIET_IRQ_VECTOR
 
 #define APIC_SPI_VECTOR 0xFF
 
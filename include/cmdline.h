@@ -70,6 +70,14 @@ extern bool opt_poweroff;
 extern bool opt_fb_scroll;
 extern unsigned long opt_reboot_timeout;
 extern bool opt_tlb_global;
+extern bool opt_sched_steal;
+extern bool opt_sched_preempt;
+extern unsigned long opt_sched_quantum;
+extern bool opt_tickless;
+extern bool opt_printk_async;
+extern bool opt_serial_tx_irq;
+extern unsigned long opt_trace_size;
+extern unsigned long opt_trace_port;
 
 extern const char *kernel_cmdline;
 
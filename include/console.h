@@ -37,6 +37,9 @@ typedef struct console_callback_entry console_callback_entry_t;
 
 extern void vprintk(const char *fmt, va_list args);
 extern void printk(const char *fmt, ...);
+extern void init_printk_async(void);
+extern void printk_flush(void);
+extern void printk_sync(void);
 
 #define dprintk(fmt, ...)                                                                \
     do {                                                                                 \
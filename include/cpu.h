@@ -26,29 +26,68 @@
 #define KTF_CPU_H
 
 #include <atomic.h>
+#include <cpumask.h>
+#include <idle.h>
 #include <ktf.h>
 #include <lib.h>
 #include <list.h>
+#include <mpsc.h>
 #include <percpu.h>
 #include <spinlock.h>
+#include <timer.h>
 
 #define CPU_UNBLOCKED (1 << 0)
 #define CPU_FINISHED  (1 << 1)
 
+#define MAX_TASK_GROUPS 4
+
 struct cpu_flags {
     uint64_t bsp : 1, enabled : 1, rsvd : 62;
 };
 typedef struct cpu_flags cpu_flags_t;
 
+/* Position within the package, decoded from the APIC ID */
+struct cpu_topology {
+    unsigned int thread;
+    unsigned int core;
+    unsigned int package;
+};
+typedef struct cpu_topology cpu_topology_t;
+
 struct cpu {
     list_head_t list;
     percpu_t *percpu;
     spinlock_t lock;
-    list_head_t task_queue;
+    mpsc_queue_t run_queue;  /* Newly scheduled tasks, any CPU may add */
+    list_head_t task_queue;  /* Owner CPU only */
+    list_head_t steal_queue; /* Protected by lock */
+    unsigned int nr_steal_tasks;
+    atomic_t nr_tasks[MAX_TASK_GROUPS];
     atomic_t run_state;
 
+    void *sched_sp;          /* Scheduler stack, while a task runs on its own */
+    list_head_t task_stacks; /* Free preemptible task stacks */
+    unsigned int nr_preempted;
+    list_head_t dead_tasks; /* Destroyed, but not freed yet */
+    idle_state_t idle;      /* Cleared by wake_cpu() */
+    atomic_t nr_wakeups;    /* Blocked tasks woken up by task_wake() */
+
+    list_head_t timers;  /* Pending, sorted by expiry. Owner CPU only */
+    timer_t slice_timer; /* End of the time slice of a task (tickless) */
+
+    uint64_t sched_start_tsc; /* Last run_tasks() window */
+    uint64_t sched_end_tsc;
+    uint64_t busy_cycles; /* Time spent running tasks within the window */
+    uint64_t wait_cycles; /* Time tasks spent queued within the window */
+    uint64_t run_min;     /* Of the task executions completed within the window */
+    uint64_t run_max;
+    uint64_t run_total;
+    unsigned int nr_executed;
+    unsigned int nr_stolen; /* Tasks taken from other CPUs' steal queues */
+
     unsigned int id;
     cpu_flags_t flags;
+    cpu_topology_t topology;
 };
 typedef struct cpu cpu_t;
 
@@ -58,12 +97,16 @@ extern cpu_t *init_cpus(void);
 extern cpu_t *add_cpu(unsigned int id, bool bsp, bool enabled);
 extern cpu_t *get_cpu(unsigned int id);
 extern cpu_t *get_bsp_cpu(void);
+extern cpu_t *get_next_cpu(const cpu_t *cpu);
 extern unsigned int get_nr_cpus(void);
 extern void for_each_cpu(void (*func)(cpu_t *cpu));
 extern void unblock_all_cpus(void);
 extern void block_all_cpus(void);
 extern void finish_all_cpus(void);
 extern void wait_for_all_cpus(void);
+extern void init_cpu_topology(void);
+extern void get_cpu_siblings(const cpu_t *cpu, cpumask_t *mask);
+extern void get_cpus_mask(cpumask_t *mask);
 
 /* Static declarations */
 
@@ -85,6 +128,7 @@ static inline bool is_cpu_finished(cpu_t *cpu) {
 
 static inline void set_cpu_finished(cpu_t *cpu) {
     atomic_test_and_set_bit(CPU_FINISHED, &cpu->run_state);
+    wake_waiters();
 }
 
 static inline void set_cpu_unfinished(cpu_t *cpu) {
@@ -103,9 +147,12 @@ static inline void set_cpu_blocked(cpu_t *cpu) {
     atomic_test_and_reset_bit(CPU_UNBLOCKED, &cpu->run_state);
 }
 
+static inline unsigned int get_cpu_nr_tasks(const cpu_t *cpu, unsigned int group) {
+    return atomic_read(&cpu->nr_tasks[group]);
+}
+
 static inline void wait_cpu_unblocked(cpu_t *cpu) {
-    while (!is_cpu_unblocked(cpu))
-        cpu_relax();
+    cpu_idle_wait(cpu, is_cpu_unblocked(cpu));
 }
 
 #endif /* KTF_CPU_H */
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_CPUMASK_H
+#define KTF_CPUMASK_H
+
+#include <bitmap.h>
+#include <ktf.h>
+#include <lib.h>
+#include <string.h>
+
+/* Masks are indexed by cpu->id */
+#define MAX_CPUS 512
+
+struct cpumask {
+    unsigned long bits[BITS_TO_LONGS(MAX_CPUS)];
+};
+typedef struct cpumask cpumask_t;
+
+#define CPUMASK_BITMAP(mask)                                                             \
+    ((bitmap_t){.word = (unsigned long *) (mask)->bits, .nbits = MAX_CPUS})
+
+/* Static declarations */
+
+static inline void cpumask_clear(cpumask_t *mask) {
+    memset(mask->bits, 0, sizeof(mask->bits));
+}
+
+static inline void cpumask_set_cpu(cpumask_t *mask, unsigned int cpu) {
+    bitmap_t map = CPUMASK_BITMAP(mask);
+
+    bitmap_set_bit(&map, cpu);
+}
+
+static inline void cpumask_clear_cpu(cpumask_t *mask, unsigned int cpu) {
+    bitmap_t map = CPUMASK_BITMAP(mask);
+
+    bitmap_clear_bit(&map, cpu);
+}
+
+static inline bool cpumask_test_cpu(const cpumask_t *mask, unsigned int cpu) {
+    bitmap_t map = CPUMASK_BITMAP(mask);
+
+    return bitmap_test_bit(&map, cpu);
+}
+
+static inline unsigned int cpumask_first(const cpumask_t *mask) {
+    bitmap_t map = CPUMASK_BITMAP(mask);
+
+    return bitmap_find_first_set(&map);
+}
+
+static inline bool cpumask_empty(const cpumask_t *mask) {
+    return cpumask_first(mask) == UINT_MAX;
+}
+
+/* Kernel is not linked against libgcc, so no __builtin_popcount() */
+static inline unsigned int cpumask_weight(const cpumask_t *mask) {
+    unsigned int weight = 0;
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(mask->bits); i++) {
+        for (unsigned long bits = mask->bits[i]; bits; bits &= bits - 1)
+            weight++;
+    }
+
+    return weight;
+}
+
+#endif /* KTF_CPUMASK_H */
@@ -169,6 +169,8 @@ typedef union interrupt_identification_register iir_t;
 #define UART_IIR_FIFO_UNUSABLE_FIFO 0x1
 #define UART_IIR_FIFO_ENABLED       0x3
 
+#define UART_TX_FIFO_SIZE 16
+
 enum com_irq {
     COM1_IRQ = 4, /* IRQ 4 */
     COM2_IRQ = 3, /* IRQ 3 */
@@ -205,6 +207,7 @@ extern void init_uart_input(const cpu_t *cpu);
 extern void uart_interrupt_handler(void);
 extern int serial_putchar(io_port_t port, char c);
 extern int serial_write(io_port_t port, const char *buf, size_t len);
+extern void serial_sync(void);
 
 extern void display_uart_config(com_idx_t com, const uart_config_t *cfg);
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_IDLE_H
+#define KTF_IDLE_H
+
+#include <ktf.h>
+#include <lib.h>
+
+enum idle_mode {
+    IDLE_MODE_POLL,
+    IDLE_MODE_HLT,
+    IDLE_MODE_MWAIT,
+};
+typedef enum idle_mode idle_mode_t;
+
+enum idle_state {
+    CPU_AWAKE = 0,
+    CPU_IDLE_MWAIT,
+    CPU_IDLE_HALT,
+};
+typedef enum idle_state idle_state_t;
+
+struct cpu;
+
+/* External declarations */
+
+extern idle_mode_t idle_mode;
+
+extern void init_idle(void);
+extern bool set_idle_mode(idle_mode_t mode);
+extern const char *idle_mode_name(idle_mode_t mode);
+
+extern unsigned long idle_prepare(struct cpu *cpu, const volatile void *addr);
+extern void idle_enter(struct cpu *cpu);
+extern void idle_exit(struct cpu *cpu, unsigned long flags);
+extern void wake_cpu(struct cpu *cpu);
+extern void wake_waiters(void);
+
+extern void wakeup_interrupt_handler(void);
+
+/* Static declarations */
+
+#define __cpu_wait(cpu, addr, cond)                                                      \
+    do {                                                                                 \
+        while (!(cond)) {                                                                \
+            unsigned long __flags = idle_prepare((cpu), (addr));                         \
+            if (!(cond))                                                                 \
+                idle_enter((cpu));                                                       \
+            idle_exit((cpu), __flags);                                                   \
+        }                                                                                \
+    } while (0)
+
+/* Wait until cond becomes true. The addr is the location, whose update makes the
+ * cond true. It is monitored in MWAIT mode, in HLT mode the current CPU halts and
+ * whoever makes the cond true must call wake_waiters() afterwards.
+ */
+#define cpu_wait(addr, cond) __cpu_wait(NULL, addr, cond)
+
+/* Wait on the given (current) CPU until cond becomes true. The CPU may mwait
+ * or halt, hence whoever makes the cond true must call wake_cpu() afterwards.
+ */
+#define cpu_idle_wait(cpu, cond) __cpu_wait(cpu, NULL, cond)
+
+#endif /* KTF_IDLE_H */
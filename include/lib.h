@@ -167,6 +167,18 @@ static inline void hlt(void) {
     asm volatile("hlt");
 }
 
+static inline void safe_halt(void) {
+    asm volatile("sti; hlt" ::: "memory");
+}
+
+static inline void monitor(const volatile void *addr, uint32_t ecx, uint32_t edx) {
+    asm volatile("monitor" ::"a"(addr), "c"(ecx), "d"(edx));
+}
+
+static inline void mwait(uint32_t eax, uint32_t ecx) {
+    asm volatile("mwait" ::"a"(eax), "c"(ecx) : "memory");
+}
+
 static inline void int3(void) {
     asm volatile("int3");
 }
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_MPSC_H
+#define KTF_MPSC_H
+
+#include <atomic.h>
+#include <ktf.h>
+#include <lib.h>
+
+/* Intrusive multi-producer single-consumer queue (Vyukov).
+ * Producers are wait-free: a single xchg on the head pointer publishes a node.
+ * Only one consumer (e.g. the owning CPU) may call mpsc_pop().
+ */
+struct mpsc_node {
+    struct mpsc_node *next;
+};
+typedef struct mpsc_node mpsc_node_t;
+
+struct mpsc_queue {
+    mpsc_node_t *head __aligned(64); /* Producers side */
+    mpsc_node_t *tail __aligned(64); /* Consumer side */
+    mpsc_node_t stub;
+};
+typedef struct mpsc_queue mpsc_queue_t;
+
+/* Static declarations */
+
+static inline void mpsc_init(mpsc_queue_t *q) {
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_push(mpsc_queue_t *q, mpsc_node_t *node) {
+    mpsc_node_t *prev;
+
+    ACCESS_ONCE(node->next) = NULL;
+    prev = xchg(&q->head, node);
+    /* Between the xchg and this store the queue is transiently unlinked */
+    ACCESS_ONCE(prev->next) = node;
+}
+
+/* Publish a chain of nodes, already linked from first to last, with a single xchg */
+static inline void mpsc_push_chain(mpsc_queue_t *q, mpsc_node_t *first,
+                                   mpsc_node_t *last) {
+    mpsc_node_t *prev;
+
+    ACCESS_ONCE(last->next) = NULL;
+    prev = xchg(&q->head, last);
+    ACCESS_ONCE(prev->next) = first;
+}
+
+static inline bool mpsc_is_empty(const mpsc_queue_t *q) {
+    return ACCESS_ONCE(q->tail) == &q->stub && ACCESS_ONCE(q->head) == &q->stub;
+}
+
+/* Returns NULL when the queue is empty or a producer is half-way through a push */
+static inline mpsc_node_t *mpsc_pop(mpsc_queue_t *q) {
+    mpsc_node_t *tail = q->tail;
+    mpsc_node_t *next = ACCESS_ONCE(tail->next);
+
+    if (tail == &q->stub) {
+        if (!next)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = ACCESS_ONCE(next->next);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    if (tail != ACCESS_ONCE(q->head))
+        return NULL;
+
+    mpsc_push(q, &q->stub);
+
+    next = ACCESS_ONCE(tail->next);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+#define mpsc_entry(node, type, member) container_of(node, type, member)
+
+#endif /* KTF_MPSC_H */
@@ -33,6 +33,8 @@
 
 struct percpu {
     list_head_t list;
+    struct percpu *self;
+    struct cpu *cpu;
 
     uint32_t acpi_id;
     uint32_t apic_id;
@@ -59,10 +61,34 @@ struct percpu {
 
     unsigned long usermode_private;
     volatile unsigned long apic_ticks;
+    unsigned long irq_count; /* All interrupts taken */
     bool apic_timer_enabled;
+    bool apic_tsc_deadline;     /* Timer in TSC-deadline mode */
+    uint32_t apic_ticks_per_ms; /* Calibrated, with divide by 16 */
+    int64_t tsc_offset;         /* Relative to the BSP's TSC */
+
+    struct task *current_task; /* Running preemptible task */
+
+    /* The rest of the page holds DEFINE_PERCPU() variables and alloc_percpu() areas */
+    uint8_t area[] __aligned(16);
 } __aligned(PAGE_SIZE);
 typedef struct percpu percpu_t;
 
+#define PERCPU_AREA_OFFSET offsetof(percpu_t, area)
+#define PERCPU_AREA_SIZE   (PAGE_SIZE - PERCPU_AREA_OFFSET)
+
+/* Offset of a per-CPU variable from the per-CPU page (and the %gs base) */
+typedef unsigned long percpu_off_t;
+
+extern unsigned char __start_percpu[], __end_percpu[];
+
+/* The variable in the section is the template, each CPU gets an own copy of it */
+#define DEFINE_PERCPU(type, name)  __section(".data.percpu") __used type percpu__##name
+#define DECLARE_PERCPU(type, name) extern __section(".data.percpu") type percpu__##name
+
+#define percpu_var_offset(name)                                                          \
+    ((percpu_off_t) (PERCPU_AREA_OFFSET + (_ul(&percpu__##name) - _ul(__start_percpu))))
+
 #define PERCPU_VAR(variable)    memberof(percpu_t, variable)
 #define PERCPU_OFFSET(variable) ((off_t) &PERCPU_VAR(variable))
 #define PERCPU_TYPE(variable)   typeof(PERCPU_VAR(variable))
@@ -125,9 +151,66 @@ typedef struct percpu percpu_t;
     })
 /* clang-format on */
 
+/* Scalar accesses at a dynamic offset from %gs. A single instruction each, so safe
+ * against interrupts on the local CPU.
+ */
+#define percpu_read(type, off)                                                           \
+    ({                                                                                   \
+        type __percpu_val;                                                               \
+        BUILD_BUG_ON(sizeof(type) > PERCPU_SET_MAX_SIZE);                                \
+        asm volatile("mov %%gs:(%[offset]), %[val]"                                      \
+                     : [ val ] "=r"(__percpu_val)                                        \
+                     : [ offset ] "r"(off)                                               \
+                     : "memory");                                                        \
+        __percpu_val;                                                                    \
+    })
+
+#define percpu_write(type, off, value)                                                   \
+    ({                                                                                   \
+        BUILD_BUG_ON(sizeof(type) > PERCPU_SET_MAX_SIZE);                                \
+        asm volatile("mov %[val], %%gs:(%[offset])"                                      \
+                     :                                                                   \
+                     : [ val ] "r"((type) (value)), [ offset ] "r"(off)                  \
+                     : "memory");                                                        \
+    })
+
+#define percpu_add(type, off, n)                                                         \
+    ({                                                                                   \
+        BUILD_BUG_ON(sizeof(type) > PERCPU_SET_MAX_SIZE);                                \
+        asm volatile("add %[val], %%gs:(%[offset])"                                      \
+                     :                                                                   \
+                     : [ val ] "r"((type) (n)), [ offset ] "r"(off)                      \
+                     : "cc", "memory");                                                  \
+    })
+
+#define this_cpu_read(name) percpu_read(typeof(percpu__##name), percpu_var_offset(name))
+#define this_cpu_write(name, value)                                                      \
+    percpu_write(typeof(percpu__##name), percpu_var_offset(name), value)
+#define this_cpu_add(name, n)                                                            \
+    percpu_add(typeof(percpu__##name), percpu_var_offset(name), n)
+#define this_cpu_inc(name) this_cpu_add(name, 1)
+
+#define this_cpu_ptr(name)                                                               \
+    ((typeof(percpu__##name) *) this_percpu_ptr(percpu_var_offset(name)))
+#define per_cpu_ptr(name, percpu)                                                        \
+    ((typeof(percpu__##name) *) percpu_ptr((percpu), percpu_var_offset(name)))
+
 /* External declarations */
 
 extern void init_percpu(void);
 extern percpu_t *get_percpu_page(unsigned int cpu);
+extern void for_each_percpu(void (*func)(percpu_t *percpu));
+extern percpu_off_t alloc_percpu(size_t size);
+extern void free_percpu(percpu_off_t off, size_t size);
+
+/* Static declarations */
+
+static inline void *percpu_ptr(percpu_t *percpu, percpu_off_t off) {
+    return (void *) percpu + off;
+}
+
+static inline void *this_percpu_ptr(percpu_off_t off) {
+    return percpu_ptr(PERCPU_GET(self), off);
+}
 
 #endif /* KTF_PERCPU_H */
@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_QUIET_H
+#define KTF_QUIET_H
+
+#include <cpumask.h>
+#include <ktf.h>
+
+/* Interrupt-free measurement window. While it is open, all IOAPIC lines (PIT/HPET
+ * tick, UART, keyboard, ...) are masked except for the GSIs to keep, and the CPUs
+ * of the window have their local APIC timer stopped. Nothing relying on the
+ * stopped ticks (e.g. msleep()) may be used inside a window. Only one window may
+ * be open at a time.
+ */
+struct quiet_window {
+    cpumask_t cpus;
+    unsigned long irq_count; /* Of the CPU that opened the window */
+    uint64_t start_tsc;
+};
+typedef struct quiet_window quiet_window_t;
+
+/* External declarations */
+
+extern int quiet_enter(quiet_window_t *window, const cpumask_t *cpus,
+                       const uint32_t *keep_gsis, unsigned int nr_keep);
+extern unsigned long quiet_exit(quiet_window_t *window);
+
+extern void quiet_interrupt_handler(void);
+
+#endif /* KTF_QUIET_H */
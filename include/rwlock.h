@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_RWLOCK_H
+#define KTF_RWLOCK_H
+
+#include <atomic.h>
+#include <ktf.h>
+#include <lib.h>
+#include <spinlock.h>
+
+/* Reader-writer spinlock: the low bits count active readers, the top bit marks
+ * the writer. Readers only share a cache line, they never wait for each other.
+ * Waiting writers do not block new readers, so readers may nest safely. The flip
+ * side is that a writer starves for as long as readers keep overlapping, so this
+ * lock is meant for read-mostly data with short, not back-to-back read sections.
+ */
+#define RWLOCK_WRITER (_U32(1) << 31)
+
+struct rwlock {
+    volatile uint32_t cnt;
+};
+typedef struct rwlock rwlock_t;
+#define RWLOCK_INIT {0}
+
+/* Sequence lock: writers serialize on the spinlock and make the sequence odd while
+ * updating. Readers never write shared state, they retry when the sequence moved.
+ */
+struct seqlock {
+    volatile unsigned int sequence;
+    spinlock_t lock;
+};
+typedef struct seqlock seqlock_t;
+#define SEQLOCK_INIT {0, SPINLOCK_INIT}
+
+/* Static declarations */
+
+static inline void rwlock_init(rwlock_t *lock) {
+    ASSERT(lock);
+    lock->cnt = 0;
+}
+
+static inline void read_lock(rwlock_t *lock) {
+    uint32_t cnt;
+
+    for (;;) {
+        cnt = ACCESS_ONCE(lock->cnt);
+        if (!(cnt & RWLOCK_WRITER) && cmpxchg(&lock->cnt, cnt, cnt + 1) == cnt)
+            break;
+        cpu_relax();
+    }
+}
+
+static inline void read_unlock(rwlock_t *lock) {
+    asm volatile("lock decl %[cnt]" : [ cnt ] "+m"(lock->cnt) : : "cc", "memory");
+}
+
+static inline void write_lock(rwlock_t *lock) {
+    while (ACCESS_ONCE(lock->cnt) != 0 || cmpxchg(&lock->cnt, 0, RWLOCK_WRITER) != 0)
+        cpu_relax();
+}
+
+static inline void write_unlock(rwlock_t *lock) {
+    /* Only the writer holds the lock, a plain store has release semantics on x86 */
+    barrier();
+    ACCESS_ONCE(lock->cnt) = 0;
+}
+
+static inline unsigned long write_lock_irqsave(rwlock_t *lock) {
+    unsigned long flags = interrupts_disable_save();
+
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t *lock, unsigned long flags) {
+    write_unlock(lock);
+    interrupts_restore(flags);
+}
+
+static inline void seqlock_init(seqlock_t *sl) {
+    ASSERT(sl);
+    sl->sequence = 0;
+    spin_lock_init(&sl->lock);
+}
+
+/* x86 does not reorder loads with other loads, or stores with other stores, so
+ * compiler barriers are enough to order the sequence against the protected data.
+ */
+static inline unsigned int read_seqbegin(const seqlock_t *sl) {
+    unsigned int seq;
+
+    while ((seq = ACCESS_ONCE(sl->sequence)) & 1)
+        cpu_relax();
+    barrier();
+
+    return seq;
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, unsigned int start) {
+    barrier();
+    return ACCESS_ONCE(sl->sequence) != start;
+}
+
+static inline void write_seqlock(seqlock_t *sl) {
+    spin_lock(&sl->lock);
+    ACCESS_ONCE(sl->sequence) = sl->sequence + 1;
+    barrier();
+}
+
+static inline void write_sequnlock(seqlock_t *sl) {
+    barrier();
+    ACCESS_ONCE(sl->sequence) = sl->sequence + 1;
+    spin_unlock(&sl->lock);
+}
+
+#endif /* KTF_RWLOCK_H */
@@ -26,10 +26,13 @@
 #define KTF_SCHED_H
 
 #include <cpu.h>
+#include <cpumask.h>
 #include <ktf.h>
 #include <lib.h>
 #include <list.h>
+#include <mpsc.h>
 #include <page.h>
+#include <time.h>
 
 typedef unsigned long (*task_func_t)(void *arg);
 
@@ -38,6 +41,7 @@ enum task_state {
     TASK_STATE_READY,
     TASK_STATE_SCHEDULED,
     TASK_STATE_RUNNING,
+    TASK_STATE_SUSPENDED,
     TASK_STATE_DONE,
 };
 typedef enum task_state task_state_t;
@@ -64,8 +68,16 @@ typedef enum task_repeat {
     TASK_REPEAT_ONCE = 1,
 } task_repeat_t;
 
+/* TSC based accounting, updated on task state transitions */
+struct task_stats {
+    uint64_t state_tsc;   /* Last transition */
+    uint64_t exec_cycles; /* Running time of the current execution */
+};
+typedef struct task_stats task_stats_t;
+
 struct task {
     list_head_t list;
+    mpsc_node_t run_node;
 
     tid_t id;
     task_type_t type;
@@ -77,29 +89,75 @@ struct task {
     cpu_t *cpu;
     void *stack;
 
+    void *kstack; /* Own stack of a preemptible task or coroutine */
+    void *sp;     /* Saved stack pointer, while switched out */
+    time_t slice_end;
+    time_t wakeup_ticks;
+    const volatile bool *blocked_on; /* Parked until the flag gets set */
+    bool coroutine;
+    bool preempted;
+
+    list_head_t dependents; /* Tasks waiting for this one to complete */
+    atomic_t nr_deps;       /* Unmet dependencies, plus one until scheduled */
+    bool balanced;          /* No hard CPU affinity */
+    cpumask_t affinity;     /* Allowed CPUs, any when empty */
+
     const char *name;
     task_func_t func;
     void *arg;
 
     unsigned long result;
+    task_stats_t stats;
 };
 typedef struct task task_t;
 
+/* Order in which schedule_tasks_placed() fills the CPUs */
+enum cpu_placement {
+    CPU_PLACEMENT_SPREAD, /* One task per physical core first, then SMT siblings */
+    CPU_PLACEMENT_PACK,   /* All SMT siblings of a core first */
+};
+typedef enum cpu_placement cpu_placement_t;
+
 /* External declarations */
 
 extern void init_tasks(void);
 extern task_t *get_task_by_name(cpu_t *cpu, const char *name);
 extern task_t *new_task(const char *name, task_func_t func, void *arg, task_type_t type);
 extern int schedule_task(task_t *task, cpu_t *cpu);
+extern int schedule_task_balanced(task_t *task);
+extern int schedule_tasks_batch(task_t *tasks[], unsigned int n, cpu_t *cpu);
+extern int schedule_on_all_cpus(const char *name, task_func_t func, void *arg);
+extern int schedule_tasks_placed(task_t *tasks[], unsigned int n,
+                                 cpu_placement_t placement);
+extern int task_depends_on(task_t *task, task_t *dep);
 extern void run_tasks(cpu_t *cpu);
 extern void wait_for_task_group(const cpu_t *cpu, task_group_t group);
+extern void sched_tick(void);
+extern void task_yield(void);
+extern int task_sleep_ms(time_t ms);
+extern void task_block(const volatile bool *flag);
+extern void task_wake(task_t *task);
+extern void print_sched_stats(void);
+extern unsigned int get_nr_pooled_tasks(void);
 
 /* Static declarations */
 
+/* The running preemptible task or coroutine, NULL on the scheduler stack */
+static inline task_t *get_current_task(void) {
+    return PERCPU_GET(current_task);
+}
+
 static inline void set_task_group(task_t *task, task_group_t gid) {
+    /* Group task accounting starts when the task gets scheduled */
+    ASSERT(task->state < TASK_STATE_SCHEDULED);
     task->gid = gid;
 }
 
+static inline void set_task_affinity(task_t *task, const cpumask_t *mask) {
+    ASSERT(task->state < TASK_STATE_SCHEDULED);
+    task->affinity = *mask;
+}
+
 static inline void wait_for_cpu_tasks(cpu_t *cpu) {
     wait_for_task_group(cpu, TASK_GROUP_ALL);
 }
@@ -108,6 +166,17 @@ static inline task_t *new_kernel_task(const char *name, task_func_t func, void *
     return new_task(name, func, arg, TASK_TYPE_KERNEL);
 }
 
+/* Coroutines run on their own stack and may give up the CPU with task_yield() or
+ * task_sleep_ms(), letting other tasks run in the meantime.
+ */
+static inline task_t *new_coroutine_task(const char *name, task_func_t func, void *arg) {
+    task_t *task = new_task(name, func, arg, TASK_TYPE_KERNEL);
+
+    if (task)
+        task->coroutine = true;
+    return task;
+}
+
 static inline task_t *new_user_task(const char *name, task_func_t func, void *arg) {
     return new_task(name, func, arg, TASK_TYPE_USER);
 }
@@ -116,6 +185,7 @@ static inline void execute_tasks(void) {
     unblock_all_cpus();
     run_tasks(get_bsp_cpu());
     wait_for_all_cpus();
+    print_sched_stats();
 }
 
 static inline void set_task_repeat(task_t *task, task_repeat_t value) {
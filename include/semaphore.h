@@ -27,19 +27,23 @@
 
 #include <atomic.h>
 #include <ktf.h>
+#include <waitqueue.h>
 
+/* Waiters are parked on the wait queue, when running on their own task stack */
 struct sem {
     atomic_t v;
+    wait_queue_t wq;
 };
 typedef struct sem sem_t;
 
 #define MAX_SEMAPHORE_VALUE (_U32(-1) / 2)
-#define SEM_INIT(value)                                                                  \
-    { .v = {(value)}, }
+#define SEM_INIT(name, value)                                                            \
+    { .v = {(value)}, .wq = WAIT_QUEUE_INIT((name).wq), }
 
 extern int32_t sem_value(const sem_t *sem);
 
 extern void sem_init(sem_t *sem, uint32_t value);
+extern void sem_destroy(sem_t *sem);
 extern bool sem_trywait(sem_t *sem);
 extern void sem_wait(sem_t *sem);
 extern void sem_post(sem_t *sem);
@@ -47,5 +51,6 @@ extern void sem_post(sem_t *sem);
 extern bool sem_trywait_units(sem_t *sem, int32_t units);
 extern void sem_wait_units(sem_t *sem, int32_t units);
 extern void sem_post_units(sem_t *sem, int32_t units);
+extern int sem_wait_units_timeout(sem_t *sem, int32_t units, uint64_t timeout_us);
 
 #endif /* KTF_SEMAPHORE_H */
@@ -31,23 +31,232 @@
 
 #define LOCK_BIT 0U
 
-typedef volatile unsigned int spinlock_t;
+/* Test-and-set lock, also used as test-and-test-and-set lock */
+typedef volatile unsigned int tas_lock_t;
+#define TAS_LOCK_INIT (0U)
 
-#define SPINLOCK_INIT (0U)
+/* FIFO ticket lock: take the next ticket, wait for it to be served */
+struct ticket_lock {
+    volatile uint16_t owner;
+    volatile uint16_t next;
+};
+typedef struct ticket_lock ticket_lock_t;
+#define TICKET_LOCK_INIT {0, 0}
+
+/* MCS queue lock: every waiter spins on its own queue node only */
+struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile bool locked;
+};
+typedef struct mcs_node mcs_node_t;
+
+struct mcs_lock {
+    mcs_node_t *volatile tail;
+    mcs_node_t *owner;
+};
+typedef struct mcs_lock mcs_lock_t;
+#define MCS_LOCK_INIT {NULL, NULL}
+
+/* External declarations */
+
+extern void mcs_lock(mcs_lock_t *lock);
+extern void mcs_unlock(mcs_lock_t *lock);
 
 /* Static declarations */
 
-static inline void spin_lock(spinlock_t *lock) {
-    ASSERT(lock);
+static inline void tas_lock(tas_lock_t *lock) {
     while (atomic_test_and_set_bit(LOCK_BIT, lock))
         cpu_relax();
 }
 
+/* Spin on a shared copy of the cache line, only try the RMW once the lock looks free */
+static inline void ttas_lock(tas_lock_t *lock) {
+    while (atomic_test_and_set_bit(LOCK_BIT, lock)) {
+        while (ACCESS_ONCE(*lock))
+            cpu_relax();
+    }
+}
+
+static inline void tas_unlock(tas_lock_t *lock) {
+    atomic_test_and_reset_bit(LOCK_BIT, lock);
+}
+
+static inline void ticket_lock(ticket_lock_t *lock) {
+    uint16_t ticket = 1;
+
+    asm volatile("lock xaddw %[ticket], %[next]"
+                 : [ ticket ] "+r"(ticket), [ next ] "+m"(lock->next)
+                 :
+                 : "memory");
+
+    while (ACCESS_ONCE(lock->owner) != ticket)
+        cpu_relax();
+}
+
+static inline void ticket_unlock(ticket_lock_t *lock) {
+    /* Only the holder writes owner, a plain store has release semantics on x86 */
+    barrier();
+    ACCESS_ONCE(lock->owner) = lock->owner + 1;
+}
+
+static inline bool tas_is_locked(const tas_lock_t *lock) {
+    return ACCESS_ONCE(*lock) != 0;
+}
+
+static inline bool ticket_is_locked(const ticket_lock_t *lock) {
+    return ACCESS_ONCE(lock->owner) != ACCESS_ONCE(lock->next);
+}
+
+static inline bool mcs_is_locked(const mcs_lock_t *lock) {
+    return ACCESS_ONCE(lock->tail) != NULL;
+}
+
+/* The spinlock_t implementation is selected at build time with CONFIG_SPINLOCK */
+#if defined(KTF_SPINLOCK_TAS)
+typedef tas_lock_t raw_spinlock_t;
+#define RAW_SPINLOCK_INIT        TAS_LOCK_INIT
+#define SPINLOCK_NAME            "tas"
+#define raw_spin_lock(lock)      tas_lock(lock)
+#define raw_spin_unlock(lock)    tas_unlock(lock)
+#define raw_spin_is_locked(lock) tas_is_locked(lock)
+#elif defined(KTF_SPINLOCK_TTAS)
+typedef tas_lock_t raw_spinlock_t;
+#define RAW_SPINLOCK_INIT        TAS_LOCK_INIT
+#define SPINLOCK_NAME            "ttas"
+#define raw_spin_lock(lock)      ttas_lock(lock)
+#define raw_spin_unlock(lock)    tas_unlock(lock)
+#define raw_spin_is_locked(lock) tas_is_locked(lock)
+#elif defined(KTF_SPINLOCK_MCS)
+typedef mcs_lock_t raw_spinlock_t;
+#define RAW_SPINLOCK_INIT        MCS_LOCK_INIT
+#define SPINLOCK_NAME            "mcs"
+#define raw_spin_lock(lock)      mcs_lock(lock)
+#define raw_spin_unlock(lock)    mcs_unlock(lock)
+#define raw_spin_is_locked(lock) mcs_is_locked(lock)
+#else
+typedef ticket_lock_t raw_spinlock_t;
+#define RAW_SPINLOCK_INIT        TICKET_LOCK_INIT
+#define SPINLOCK_NAME            "ticket"
+#define raw_spin_lock(lock)      ticket_lock(lock)
+#define raw_spin_unlock(lock)    ticket_unlock(lock)
+#define raw_spin_is_locked(lock) ticket_is_locked(lock)
+#endif
+
+#ifdef KTF_LOCKSTAT
+/* Contention statistics of a spinlock, only updated by the lock holder */
+struct lockstat {
+    struct lockstat *next;
+    const void *first_ip;
+    const void *holder_ip;
+    const void *max_spin_holder_ip;
+    unsigned long acquisitions;
+    unsigned long contended;
+    uint64_t spin_cycles;
+    uint64_t max_spin_cycles;
+    bool registered;
+};
+typedef struct lockstat lockstat_t;
+
+struct spinlock {
+    raw_spinlock_t raw;
+    lockstat_t stat;
+};
+typedef struct spinlock spinlock_t;
+#define SPINLOCK_INIT {.raw = RAW_SPINLOCK_INIT}
+
+/* Address inside the calling function, resolved with the symbol tables */
+#define LOCKSTAT_IP ({ __label__ __here; __here: (const void *) &&__here; })
+
+extern void lockstat_register(lockstat_t *stat, const void *ip);
+extern void lockstat_unregister(lockstat_t *stat);
+extern void lockstat_report(void);
+#else
+typedef raw_spinlock_t spinlock_t;
+#define SPINLOCK_INIT RAW_SPINLOCK_INIT
+
+#define LOCKSTAT_IP NULL
+
+static inline void lockstat_report(void) {}
+#endif
+
+static inline void spin_lock_init(spinlock_t *lock) {
+    ASSERT(lock);
+#ifdef KTF_LOCKSTAT
+    /* Re-initializing a registered lock must not cut the list behind it off */
+    if (lock->stat.registered)
+        lockstat_unregister(&lock->stat);
+#endif
+    *lock = (spinlock_t) SPINLOCK_INIT;
+}
+
+/* Must be called before the memory of a dynamically allocated lock is freed */
+static inline void spin_lock_destroy(spinlock_t *lock) {
+    ASSERT(lock);
+#ifdef KTF_LOCKSTAT
+    lockstat_unregister(&lock->stat);
+#endif
+}
+
+static __always_inline void __spin_lock(spinlock_t *lock, const void *ip) {
+    ASSERT(lock);
+#ifdef KTF_LOCKSTAT
+    lockstat_t *stat = &lock->stat;
+    const void *holder = NULL;
+    uint64_t spin = 0;
+
+    if (raw_spin_is_locked(&lock->raw)) {
+        holder = ACCESS_ONCE(stat->holder_ip);
+        spin = rdtsc();
+        raw_spin_lock(&lock->raw);
+        spin = rdtsc() - spin;
+        stat->contended++;
+    }
+    else {
+        raw_spin_lock(&lock->raw);
+    }
+
+    stat->acquisitions++;
+    stat->spin_cycles += spin;
+    if (spin > stat->max_spin_cycles) {
+        stat->max_spin_cycles = spin;
+        stat->max_spin_holder_ip = holder;
+    }
+    stat->holder_ip = ip;
+
+    if (unlikely(!stat->registered))
+        lockstat_register(stat, ip);
+#else
+    raw_spin_lock(lock);
+#endif
+}
+
 static inline void spin_unlock(spinlock_t *lock) {
     ASSERT(lock);
-    atomic_test_and_reset_bit(LOCK_BIT, lock);
+#ifdef KTF_LOCKSTAT
+    raw_spin_unlock(&lock->raw);
+#else
+    raw_spin_unlock(lock);
+#endif
 }
 
-/* External declarations */
+#define spin_lock(lock) __spin_lock((lock), LOCKSTAT_IP)
+
+/* Variants for locks that are also taken from interrupt context: keep interrupts
+ * disabled while holding the lock, so an IRQ on this CPU cannot spin on it forever.
+ */
+static __always_inline unsigned long __spin_lock_irqsave(spinlock_t *lock,
+                                                        const void *ip) {
+    unsigned long flags = interrupts_disable_save();
+
+    __spin_lock(lock, ip);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags) {
+    spin_unlock(lock);
+    interrupts_restore(flags);
+}
+
+#define spin_lock_irqsave(lock) __spin_lock_irqsave((lock), LOCKSTAT_IP)
 
 #endif /* KTF_SPINLOCK_H */
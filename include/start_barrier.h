@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_START_BARRIER_H
+#define KTF_START_BARRIER_H
+
+#include <atomic.h>
+#include <cpumask.h>
+#include <ktf.h>
+
+/* Time given to all participants to notice the deadline, once the last one arrives */
+#define START_BARRIER_DELAY_CYCLES 20000
+
+/* Rendezvous of a number of CPUs, which all leave it at the same TSC deadline.
+ * Arrival counter and deadline share a single cache line.
+ */
+struct start_barrier {
+    atomic_t arrived;
+    unsigned int nr_cpus;
+    uint64_t deadline;
+} __aligned(64);
+typedef struct start_barrier start_barrier_t;
+
+/* Achieved start TSC of each participating CPU, indexed by CPU ID. Like the
+ * deadline, relative to the BSP's TSC.
+ */
+struct start_barrier_stats {
+    uint64_t deadline;
+    uint64_t start_tsc[MAX_CPUS];
+};
+typedef struct start_barrier_stats start_barrier_stats_t;
+
+extern void start_barrier_init(start_barrier_t *barrier, unsigned int nr_cpus);
+extern uint64_t start_barrier_wait(start_barrier_t *barrier);
+extern void start_barrier_record(start_barrier_stats_t *stats,
+                                 const start_barrier_t *barrier, uint64_t start);
+extern uint64_t start_barrier_report(const start_barrier_stats_t *stats);
+
+#endif /* KTF_START_BARRIER_H */
@@ -31,6 +31,7 @@ extern int msleep(time_t ms);
 extern int msleep_local(time_t ms);
 extern time_t get_timer_ticks(void);
 extern time_t get_local_ticks(void);
+extern uint64_t ktime_ns(void);
 
 /* Static declarations */
 
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_TIMER_H
+#define KTF_TIMER_H
+
+#include <ktf.h>
+#include <list.h>
+
+struct timer;
+typedef void (*timer_func_t)(struct timer *timer);
+
+/* One-shot timer, expiring on the CPU it was added on.
+ * The function is called in interrupt context and may be NULL, when the timer
+ * is only meant to wake the CPU up.
+ */
+struct timer {
+    list_head_t list;
+    struct cpu *cpu;
+    uint64_t expires; /* TSC */
+    timer_func_t func;
+    void *arg;
+    volatile bool pending;
+};
+typedef struct timer timer_t;
+
+/* External declarations */
+
+extern void init_timer(timer_t *timer, timer_func_t func, void *arg);
+extern void add_timer(timer_t *timer, uint64_t expires);
+extern bool del_timer(timer_t *timer);
+extern void run_timers(void);
+extern uint64_t us_to_tsc(uint64_t us);
+extern int usleep(uint64_t us);
+
+/* Static declarations */
+
+static inline bool timer_pending(const timer_t *timer) {
+    return ACCESS_ONCE(timer->pending);
+}
+
+#endif /* KTF_TIMER_H */
@@ -0,0 +1,140 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_TRACE_H
+#define KTF_TRACE_H
+
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+
+#define TRACE_MAGIC     "KTFTRACE"
+#define TRACE_VERSION   1
+#define TRACE_MAX_WORDS 8
+
+/* Binary event record, followed by nr_words 64-bit payload words */
+struct trace_record {
+    uint64_t tsc;
+    uint16_t id;
+    uint16_t cpu;
+    uint8_t nr_words;
+    uint8_t rsvd[3];
+    uint64_t words[];
+} __packed;
+typedef struct trace_record trace_record_t;
+
+/* Dump header, followed by a trace_cpu_header_t and its records for every CPU */
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nr_cpus;
+    uint64_t tsc_khz;
+} __packed;
+typedef struct trace_header trace_header_t;
+
+struct trace_cpu_header {
+    uint32_t cpu;
+    uint32_t rsvd;
+    uint64_t size; /* Bytes of records */
+    uint64_t dropped;
+} __packed;
+typedef struct trace_cpu_header trace_cpu_header_t;
+
+#define TRACE_CHUNK_SIZE PAGE_SIZE_2M
+
+struct trace_chunk {
+    void *base;
+    size_t used;
+};
+typedef struct trace_chunk trace_chunk_t;
+
+/* Per-CPU buffer, made of 2M chunks. Only the owning CPU writes to it */
+struct trace_buf {
+    void *cur, *end;
+    trace_chunk_t *chunks;
+    unsigned int nr_chunks;
+    unsigned int chunk;
+    unsigned int cpu;
+    uint64_t nr_events;
+    uint64_t dropped;
+};
+typedef struct trace_buf trace_buf_t;
+
+DECLARE_PERCPU(trace_buf_t, trace_buf);
+
+extern bool trace_enabled;
+
+/* External declarations */
+
+extern void init_trace(void);
+extern bool trace_next_chunk(trace_buf_t *tb, size_t size);
+extern void trace_reset(void);
+extern void trace_for_each_record(void (*func)(const trace_record_t *rec, void *arg),
+                                  void *arg);
+extern void trace_dump(void);
+
+/* Static declarations */
+
+static inline void __trace_event(uint16_t id, const uint64_t *words, unsigned int nr) {
+    size_t size = sizeof(trace_record_t) + nr * sizeof(*words);
+    unsigned long flags;
+    trace_record_t *rec;
+    trace_buf_t *tb;
+
+    if (!ACCESS_ONCE(trace_enabled))
+        return;
+
+    flags = interrupts_disable_save();
+    tb = this_cpu_ptr(trace_buf);
+
+    if (unlikely(tb->cur + size > tb->end) && !trace_next_chunk(tb, size)) {
+        tb->dropped++;
+        interrupts_restore(flags);
+        return;
+    }
+
+    rec = tb->cur;
+    rec->tsc = rdtsc();
+    rec->id = id;
+    rec->cpu = tb->cpu;
+    rec->nr_words = nr;
+    for (unsigned int i = 0; i < nr; i++)
+        rec->words[i] = words[i];
+
+    tb->cur += size;
+    tb->nr_events++;
+    interrupts_restore(flags);
+}
+
+/* Record an event with up to TRACE_MAX_WORDS payload words, without any formatting:
+ * trace_event(MY_EVENT, counts[0], counts[1]);
+ */
+#define trace_event(id, ...)                                                             \
+    do {                                                                                 \
+        const uint64_t __trace_words[] = {__VA_ARGS__};                                  \
+        BUILD_BUG_ON(sizeof(__trace_words) > TRACE_MAX_WORDS * sizeof(uint64_t));        \
+        __trace_event((id), __trace_words, sizeof(__trace_words) / sizeof(uint64_t));    \
+    } while (0)
+
+#endif /* KTF_TRACE_H */
@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef KTF_WAITQUEUE_H
+#define KTF_WAITQUEUE_H
+
+#include <ktf.h>
+#include <lib.h>
+#include <list.h>
+#include <sched.h>
+#include <spinlock.h>
+#include <timer.h>
+
+#define WAIT_FOREVER _U64(0)
+
+struct wait_queue {
+    spinlock_t lock;
+    list_head_t waiters;
+};
+typedef struct wait_queue wait_queue_t;
+
+#define WAIT_QUEUE_INIT(name)                                                            \
+    { .lock = SPINLOCK_INIT, .waiters = LIST_INIT((name).waiters) }
+
+/* Lives on the waiter's stack for the duration of a single wait */
+struct wait_entry {
+    list_head_t list;
+    task_t *task;
+    timer_t timer;
+    volatile bool woken; /* Set by wake_up(), under the queue lock */
+    volatile bool ready; /* Woken up or timed out */
+};
+typedef struct wait_entry wait_entry_t;
+
+/* External declarations */
+
+extern void init_wait_queue(wait_queue_t *wq);
+extern void prepare_to_wait(wait_queue_t *wq, wait_entry_t *entry);
+extern int wait_entry_sleep(wait_entry_t *entry, uint64_t deadline);
+extern void finish_wait(wait_queue_t *wq, wait_entry_t *entry);
+extern unsigned int wake_up_nr(wait_queue_t *wq, unsigned int nr);
+
+/* Static declarations */
+
+/* Must be called before the memory of a dynamically allocated queue is freed */
+static inline void destroy_wait_queue(wait_queue_t *wq) {
+    ASSERT(list_is_empty(&wq->waiters));
+    spin_lock_destroy(&wq->lock);
+}
+
+static inline unsigned int wake_up(wait_queue_t *wq) {
+    return wake_up_nr(wq, 1);
+}
+
+static inline unsigned int wake_up_all(wait_queue_t *wq) {
+    return wake_up_nr(wq, UINT_MAX);
+}
+
+static inline bool wait_queue_active(wait_queue_t *wq) {
+    return !list_is_empty(&wq->waiters);
+}
+
+/* Wait until cond becomes true or the TSC deadline (unless WAIT_FOREVER) passes.
+ * The cond may have side effects (like taking a resource), it is not evaluated
+ * again once true. Whoever makes cond true must call wake_up() afterwards.
+ * Evaluates to 0 or -ETIMEDOUT.
+ */
+#define wait_event_deadline(wq, cond, deadline)                                          \
+    ({                                                                                   \
+        wait_entry_t __entry;                                                            \
+        int __rc = 0;                                                                    \
+        for (;;) {                                                                       \
+            if (cond) {                                                                  \
+                __rc = 0;                                                                \
+                break;                                                                   \
+            }                                                                            \
+            if (__rc < 0)                                                                \
+                break;                                                                   \
+            prepare_to_wait((wq), &__entry);                                             \
+            if (cond) {                                                                  \
+                finish_wait((wq), &__entry);                                             \
+                __rc = 0;                                                                \
+                break;                                                                   \
+            }                                                                            \
+            __rc = wait_entry_sleep(&__entry, (deadline));                               \
+            finish_wait((wq), &__entry);                                                 \
+        }                                                                                \
+        __rc;                                                                            \
+    })
+
+#define wait_event(wq, cond) ((void) wait_event_deadline(wq, cond, WAIT_FOREVER))
+
+#endif /* KTF_WAITQUEUE_H */
@@ -23,14 +23,21 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <errno.h>
 #include <mm/slab.h>
 #include <semaphore.h>
+#include <timer.h>
 
 void sem_init(sem_t *sem, uint32_t value) {
     /* Do not allow more than 2^31-1 threads to access this semaphore */
     BUG_ON(value > MAX_SEMAPHORE_VALUE);
 
     atomic_set(&(sem->v), value);
+    init_wait_queue(&sem->wq);
+}
+
+void sem_destroy(sem_t *sem) {
+    destroy_wait_queue(&sem->wq);
 }
 
 int32_t sem_value(const sem_t *sem) {
@@ -70,21 +77,29 @@ bool sem_trywait_units(sem_t *sem, int32_t units) {
 }
 
 void sem_wait(sem_t *sem) {
-    while (!sem_trywait(sem)) {
-        cpu_relax();
-    }
+    wait_event(&sem->wq, sem_trywait(sem));
 }
 
 void sem_wait_units(sem_t *sem, int32_t units) {
-    while (!sem_trywait_units(sem, units)) {
-        cpu_relax();
-    }
+    wait_event(&sem->wq, sem_trywait_units(sem, units));
+}
+
+/* Returns -ETIMEDOUT, if the units were not available within timeout_us */
+int sem_wait_units_timeout(sem_t *sem, int32_t units, uint64_t timeout_us) {
+    uint64_t deadline = rdtsc() + us_to_tsc(timeout_us);
+
+    return wait_event_deadline(&sem->wq, sem_trywait_units(sem, units), deadline);
 }
 
+/* Waiters may wait for different numbers of units, so all of them re-check */
 void sem_post(sem_t *sem) {
     atomic_inc(&(sem->v));
+    if (wait_queue_active(&sem->wq))
+        wake_up_all(&sem->wq);
 }
 
 void sem_post_units(sem_t *sem, int32_t units) {
     atomic_add_return(&(sem->v), units);
+    if (wait_queue_active(&sem->wq))
+        wake_up_all(&sem->wq);
 }
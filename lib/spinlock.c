@@ -0,0 +1,199 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cpumask.h>
+#include <ktf.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <symbols.h>
+
+/* Nesting depth of MCS locks held or waited for by a CPU at once */
+#define MCS_NODES_PER_CPU 4
+
+struct mcs_cpu_nodes {
+    mcs_node_t nodes[MCS_NODES_PER_CPU];
+    unsigned long used;
+} __aligned(64);
+
+static struct mcs_cpu_nodes mcs_cpu_nodes[MAX_CPUS];
+
+/* CPUs with IDs beyond MAX_CPUS share the nodes of an overflow pool */
+#define MCS_OVERFLOW_NODES BITS_PER_LONG
+
+static struct {
+    mcs_node_t nodes[MCS_OVERFLOW_NODES];
+    unsigned long used;
+} mcs_overflow_nodes __aligned(64);
+
+/* TSC_AUX holds the CPU ID. It is still zero on the BSP before traps are set up */
+static inline unsigned int mcs_cpu_id(void) {
+    unsigned int id;
+
+    asm volatile("rdtscp" : "=c"(id)::"eax", "edx");
+    return id;
+}
+
+/* Nodes are taken from the CPU's pool rather than stacked, as a preempted task
+ * may release its lock after other tasks on the CPU took theirs.
+ */
+static mcs_node_t *get_mcs_node(void) {
+    unsigned int id = mcs_cpu_id();
+    struct mcs_cpu_nodes *cpu_nodes;
+
+    if (id >= MAX_CPUS) {
+        for (;;) {
+            for (unsigned int i = 0; i < MCS_OVERFLOW_NODES; i++) {
+                if (!atomic_test_and_set_bit(i, &mcs_overflow_nodes.used))
+                    return &mcs_overflow_nodes.nodes[i];
+            }
+            cpu_relax();
+        }
+    }
+
+    cpu_nodes = &mcs_cpu_nodes[id];
+
+    for (unsigned int i = 0; i < MCS_NODES_PER_CPU; i++) {
+        if (!atomic_test_and_set_bit(i, &cpu_nodes->used))
+            return &cpu_nodes->nodes[i];
+    }
+
+    BUG();
+}
+
+static void put_mcs_node(mcs_node_t *node) {
+    size_t overflow = node - mcs_overflow_nodes.nodes;
+    struct mcs_cpu_nodes *cpu_nodes;
+
+    if (overflow < MCS_OVERFLOW_NODES) {
+        atomic_test_and_reset_bit(overflow, &mcs_overflow_nodes.used);
+        return;
+    }
+
+    cpu_nodes = &mcs_cpu_nodes[(_ul(node) - _ul(mcs_cpu_nodes)) / sizeof(*cpu_nodes)];
+    atomic_test_and_reset_bit(node - cpu_nodes->nodes, &cpu_nodes->used);
+}
+
+void mcs_lock(mcs_lock_t *lock) {
+    mcs_node_t *node = get_mcs_node();
+    mcs_node_t *prev;
+
+    node->next = NULL;
+    node->locked = true;
+
+    prev = xchg(&lock->tail, node);
+    if (prev) {
+        ACCESS_ONCE(prev->next) = node;
+        while (ACCESS_ONCE(node->locked))
+            cpu_relax();
+    }
+
+    lock->owner = node;
+}
+
+void mcs_unlock(mcs_lock_t *lock) {
+    mcs_node_t *node = lock->owner;
+    mcs_node_t *next = ACCESS_ONCE(node->next);
+
+    if (!next) {
+        if (cmpxchg(&lock->tail, node, NULL) == node)
+            goto out;
+
+        /* A successor is half-way through queueing */
+        while (!(next = ACCESS_ONCE(node->next)))
+            cpu_relax();
+    }
+
+    ACCESS_ONCE(next->locked) = false;
+out:
+    put_mcs_node(node);
+}
+
+#ifdef KTF_LOCKSTAT
+#define LOCKSTAT_REPORT_MAX 128
+
+/* Registration is rare, a raw lock keeps the list itself out of the statistics */
+static raw_spinlock_t lockstat_list_lock = RAW_SPINLOCK_INIT;
+static lockstat_t *lockstat_list;
+
+/* Locks register themselves on their first acquisition */
+void lockstat_register(lockstat_t *stat, const void *ip) {
+    lockstat_t *cur;
+
+    raw_spin_lock(&lockstat_list_lock);
+    for (cur = lockstat_list; cur; cur = cur->next) {
+        if (cur == stat)
+            break;
+    }
+
+    if (!cur) {
+        stat->first_ip = ip;
+        stat->next = lockstat_list;
+        lockstat_list = stat;
+    }
+    stat->registered = true;
+    raw_spin_unlock(&lockstat_list_lock);
+}
+
+void lockstat_unregister(lockstat_t *stat) {
+    lockstat_t **pp;
+
+    raw_spin_lock(&lockstat_list_lock);
+    for (pp = &lockstat_list; *pp; pp = &(*pp)->next) {
+        if (*pp == stat) {
+            *pp = stat->next;
+            break;
+        }
+    }
+    stat->registered = false;
+    raw_spin_unlock(&lockstat_list_lock);
+}
+
+static const char *lockstat_site(const void *ip) {
+    const char *name = ip ? symbol_name(ip) : NULL;
+
+    return name ?: "-";
+}
+
+/* The statistics are copied first, printing takes the (instrumented) console lock */
+void lockstat_report(void) {
+    static lockstat_t stats[LOCKSTAT_REPORT_MAX];
+    unsigned int nr_stats = 0;
+    lockstat_t *cur;
+
+    raw_spin_lock(&lockstat_list_lock);
+    for (cur = lockstat_list; cur && nr_stats < ARRAY_SIZE(stats); cur = cur->next)
+        stats[nr_stats++] = *cur;
+    raw_spin_unlock(&lockstat_list_lock);
+
+    printk("lockstat,first_site,acquisitions,contended,spin_cycles,max_spin_cycles,"
+           "max_spin_holder\n");
+    for (unsigned int i = 0; i < nr_stats; i++) {
+        lockstat_t *stat = &stats[i];
+
+        printk("lockstat,%s,%lu,%lu,%lu,%lu,%s\n", lockstat_site(stat->first_ip),
+               stat->acquisitions, stat->contended, stat->spin_cycles,
+               stat->max_spin_cycles, lockstat_site(stat->max_spin_holder_ip));
+    }
+}
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <console.h>
+#include <cpu.h>
+#include <lib.h>
+#include <percpu.h>
+#include <start_barrier.h>
+#include <string.h>
+
+#include <smp/smp.h>
+
+void start_barrier_init(start_barrier_t *barrier, unsigned int nr_cpus) {
+    BUG_ON(nr_cpus == 0);
+
+    atomic_set(&barrier->arrived, 0);
+    barrier->nr_cpus = nr_cpus;
+    barrier->deadline = 0;
+    smp_mb();
+}
+
+/* The last CPU to arrive sets a deadline slightly in the future. Everybody spins
+ * on the TSC until then, without pause, so that the exit is as close as possible.
+ * The deadline is kept on the BSP's TSC, each CPU applies its own tsc_offset.
+ * Returns the (local) TSC at exit.
+ */
+uint64_t start_barrier_wait(start_barrier_t *barrier) {
+    int64_t offset = PERCPU_GET(tsc_offset);
+    uint64_t deadline, now;
+
+    if (atomic_inc_return(&barrier->arrived) + 1 == (int) barrier->nr_cpus) {
+        ACCESS_ONCE(barrier->deadline) = rdtsc() - offset + START_BARRIER_DELAY_CYCLES;
+    }
+    else {
+        while (!ACCESS_ONCE(barrier->deadline))
+            cpu_relax();
+    }
+
+    deadline = ACCESS_ONCE(barrier->deadline) + offset;
+    do {
+        now = rdtsc();
+    } while (now < deadline);
+
+    return now;
+}
+
+/* Kept apart from the barrier, so recording does not disturb the waiters */
+void start_barrier_record(start_barrier_stats_t *stats, const start_barrier_t *barrier,
+                          uint64_t start) {
+    unsigned int cpu = smp_processor_id();
+
+    if (cpu >= MAX_CPUS)
+        return;
+
+    stats->deadline = barrier->deadline;
+    stats->start_tsc[cpu] = start - PERCPU_GET(tsc_offset);
+}
+
+/* Returns the spread of the start TSCs between CPUs */
+uint64_t start_barrier_report(const start_barrier_stats_t *stats) {
+    cpu_t *first_cpu = get_next_cpu(NULL), *cpu = first_cpu;
+    uint64_t first = ULONG_MAX, last = 0;
+
+    do {
+        uint64_t start = cpu->id < MAX_CPUS ? stats->start_tsc[cpu->id] : 0;
+
+        if (start) {
+            printk("CPU[%u]: Start skew %lu cycles past the deadline\n", cpu->id,
+                   start - stats->deadline);
+            first = min(first, start);
+            last = max(last, start);
+        }
+
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first_cpu);
+
+    if (!last)
+        return 0;
+
+    printk("Start barrier: spread between CPUs %lu cycles\n", last - first);
+    return last - first;
+}
@@ -23,24 +23,34 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <apic.h>
+#include <cmdline.h>
 #include <errno.h>
+#include <idle.h>
+#include <lib.h>
 #include <percpu.h>
+#include <sched.h>
 #include <setup.h>
 #include <time.h>
+#include <timer.h>
 
 extern boot_flags_t boot_flags;
 
 static __aligned(16) volatile time_t ticks = 0;
+static atomic_t nr_sleepers; /* In msleep(), woken up by the tick */
 
 void timer_interrupt_handler(void) {
     asm volatile("lock incq %[ticks]" : [ ticks ] "=m"(ACCESS_ONCE(ticks)));
     apic_EOI();
+    if (atomic_read(&nr_sleepers) > 0)
+        wake_waiters();
 }
 
 void apic_timer_interrupt_handler(void) {
     asm volatile("lock incq %%gs:%[ticks]"
                  : [ ticks ] "=m"(ACCESS_ONCE(PERCPU_VAR(apic_ticks))));
     apic_EOI();
+    run_timers();
+    sched_tick();
 }
 
 int msleep(time_t ms) {
@@ -50,8 +60,9 @@ int msleep(time_t ms) {
         return -ENODEV;
 
     end = ACCESS_ONCE(ticks) + ms;
-    while (ACCESS_ONCE(ticks) < end)
-        cpu_relax();
+    atomic_inc(&nr_sleepers);
+    cpu_wait(&ticks, ACCESS_ONCE(ticks) >= end);
+    atomic_dec(&nr_sleepers);
 
     return 0;
 }
@@ -62,9 +73,23 @@ int msleep_local(time_t ms) {
     if (!PERCPU_GET(apic_timer_enabled))
         return -ENODEV;
 
+    if (opt_tickless)
+        return usleep(ms * 1000);
+
     end = PERCPU_GET(apic_ticks) + ms;
-    while (PERCPU_GET(apic_ticks) < end)
-        cpu_relax();
+    while (PERCPU_GET(apic_ticks) < end) {
+        /* The local APIC timer interrupt always wakes the CPU up */
+        if (idle_mode != IDLE_MODE_POLL && interrupts_enabled()) {
+            unsigned long flags = interrupts_disable_save();
+
+            if (PERCPU_GET(apic_ticks) < end)
+                safe_halt();
+            interrupts_restore(flags);
+        }
+        else {
+            cpu_relax();
+        }
+    }
 
     return 0;
 }
@@ -73,6 +98,7 @@ time_t get_timer_ticks(void) {
     return ACCESS_ONCE(ticks);
 }
 
+/* Without a periodic local APIC timer, the milliseconds passed are counted instead */
 time_t get_local_ticks(void) {
-    return PERCPU_GET(apic_ticks);
+    return opt_tickless ? ktime_ns() / 1000000 : PERCPU_GET(apic_ticks);
 }
@@ -0,0 +1,156 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <apic.h>
+#include <cmdline.h>
+#include <cpu.h>
+#include <errno.h>
+#include <idle.h>
+#include <lib.h>
+#include <percpu.h>
+#include <timer.h>
+#include <tsc.h>
+
+/* With tickless timers the local APIC timer fires at the earliest pending expiry
+ * only. Otherwise expired timers are run from the periodic tick.
+ */
+static void program_timer(cpu_t *cpu) {
+    if (!opt_tickless)
+        return;
+
+    if (list_is_empty(&cpu->timers))
+        apic_timer_set_deadline(0);
+    else
+        apic_timer_set_deadline(list_first_entry(&cpu->timers, timer_t, list)->expires);
+}
+
+void init_timer(timer_t *timer, timer_func_t func, void *arg) {
+    list_init(&timer->list);
+    timer->cpu = NULL;
+    timer->expires = 0;
+    timer->func = func;
+    timer->arg = arg;
+    timer->pending = false;
+}
+
+static void __del_timer(timer_t *timer) {
+    list_unlink(&timer->list);
+    timer->pending = false;
+}
+
+/* Arm the timer on the current CPU. A pending timer is re-armed */
+void add_timer(timer_t *timer, uint64_t expires) {
+    unsigned long flags = interrupts_disable_save();
+    cpu_t *cpu = PERCPU_GET(cpu);
+    list_head_t *pos;
+
+    if (timer->pending) {
+        ASSERT(timer->cpu == cpu);
+        __del_timer(timer);
+    }
+
+    timer->cpu = cpu;
+    timer->expires = expires;
+    timer->pending = true;
+
+    list_for_each (pos, &cpu->timers) {
+        if (list_entry(pos, timer_t, list)->expires > expires)
+            break;
+    }
+    list_add_tail(&timer->list, pos);
+
+    if (list_first_entry(&cpu->timers, timer_t, list) == timer)
+        program_timer(cpu);
+
+    interrupts_restore(flags);
+}
+
+/* Returns true when the timer was still pending. Must be called on the CPU
+ * the timer was added on.
+ */
+bool del_timer(timer_t *timer) {
+    unsigned long flags = interrupts_disable_save();
+    bool pending = timer->pending;
+
+    if (pending) {
+        ASSERT(timer->cpu == PERCPU_GET(cpu));
+        __del_timer(timer);
+        program_timer(timer->cpu);
+    }
+
+    interrupts_restore(flags);
+    return pending;
+}
+
+/* Called from the local APIC timer interrupt handler */
+void run_timers(void) {
+    cpu_t *cpu = PERCPU_GET(cpu);
+
+    while (!list_is_empty(&cpu->timers)) {
+        timer_t *timer = list_first_entry(&cpu->timers, timer_t, list);
+
+        if (timer->expires > rdtsc())
+            break;
+
+        __del_timer(timer);
+        if (timer->func)
+            timer->func(timer);
+    }
+
+    program_timer(cpu);
+}
+
+/* Rounded up, so that a deadline never expires early */
+uint64_t us_to_tsc(uint64_t us) {
+    return div_round_up(us * get_tsc_khz(), 1000);
+}
+
+/* Microsecond resolution with tickless timers, otherwise that of the tick */
+int usleep(uint64_t us) {
+    uint64_t expires = rdtsc() + us_to_tsc(us);
+    timer_t timer;
+
+    if (!PERCPU_GET(apic_timer_enabled))
+        return -ENODEV;
+
+    init_timer(&timer, NULL, NULL);
+    add_timer(&timer, expires);
+
+    while (rdtsc() < expires) {
+        /* The timer always wakes the CPU up */
+        if (idle_mode != IDLE_MODE_POLL && interrupts_enabled()) {
+            unsigned long flags = interrupts_disable_save();
+
+            if (timer_pending(&timer))
+                safe_halt();
+            interrupts_restore(flags);
+        }
+        else {
+            cpu_relax();
+        }
+    }
+
+    del_timer(&timer);
+    return 0;
+}
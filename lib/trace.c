@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cmdline.h>
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <string.h>
+#include <trace.h>
+#include <tsc.h>
+
+#include <mm/slab.h>
+#include <mm/vmm.h>
+
+#define TRACE_HEX_LINE 32
+
+DEFINE_PERCPU(trace_buf_t, trace_buf);
+
+bool trace_enabled;
+
+#define for_each_trace_buf(tb, cpu, first)                                               \
+    for ((cpu) = (first) = get_next_cpu(NULL); (cpu);                                    \
+         (cpu) = get_next_cpu(cpu), (cpu) = (cpu) == (first) ? NULL : (cpu))             \
+        if (((tb) = per_cpu_ptr(trace_buf, (cpu)->percpu))->chunks)
+
+/* Called with interrupts disabled, when the current chunk is full */
+bool trace_next_chunk(trace_buf_t *tb, size_t size) {
+    trace_chunk_t *chunk;
+
+    if (!tb->chunks || tb->chunk + 1 >= tb->nr_chunks || size > TRACE_CHUNK_SIZE)
+        return false;
+
+    tb->chunks[tb->chunk].used = tb->cur - tb->chunks[tb->chunk].base;
+    chunk = &tb->chunks[++tb->chunk];
+    chunk->used = 0;
+    tb->cur = chunk->base;
+    tb->end = chunk->base + TRACE_CHUNK_SIZE;
+
+    return true;
+}
+
+static void trace_buf_reset(trace_buf_t *tb) {
+    tb->chunk = 0;
+    tb->chunks[0].used = 0;
+    tb->cur = tb->chunks[0].base;
+    tb->end = tb->chunks[0].base + TRACE_CHUNK_SIZE;
+    tb->nr_events = 0;
+    tb->dropped = 0;
+}
+
+/* Discard all recorded events. Must not race with trace_event() */
+void trace_reset(void) {
+    cpu_t *cpu, *first;
+    trace_buf_t *tb;
+
+    for_each_trace_buf (tb, cpu, first)
+        trace_buf_reset(tb);
+}
+
+static inline size_t trace_chunk_used(const trace_buf_t *tb, unsigned int i) {
+    return i == tb->chunk ? _ul(tb->cur - tb->chunks[i].base) : tb->chunks[i].used;
+}
+
+void trace_for_each_record(void (*func)(const trace_record_t *rec, void *arg),
+                           void *arg) {
+    cpu_t *cpu, *first;
+    trace_buf_t *tb;
+
+    for_each_trace_buf (tb, cpu, first) {
+        for (unsigned int i = 0; i <= tb->chunk; i++) {
+            void *p = tb->chunks[i].base, *end = p + trace_chunk_used(tb, i);
+
+            while (p < end) {
+                const trace_record_t *rec = p;
+
+                func(rec, arg);
+                p += sizeof(*rec) + rec->nr_words * sizeof(rec->words[0]);
+            }
+        }
+    }
+}
+
+/* Per-CPU buffers of trace_size MB each, allocated upfront in 2M chunks, so that
+ * recording never allocates. Must be called once all CPUs are up.
+ */
+void init_trace(void) {
+    unsigned int nr_chunks = div_round_up(opt_trace_size * MB(1), TRACE_CHUNK_SIZE);
+    cpu_t *cpu = get_next_cpu(NULL), *first = cpu;
+
+    if (nr_chunks == 0)
+        return;
+
+    printk("Initializing trace buffers: %u MB per CPU\n",
+           nr_chunks * (unsigned int) (TRACE_CHUNK_SIZE / MB(1)));
+
+    do {
+        trace_buf_t *tb = per_cpu_ptr(trace_buf, cpu->percpu);
+        trace_chunk_t *chunks = kzalloc(nr_chunks * sizeof(*chunks));
+        unsigned int n;
+
+        BUG_ON(!chunks);
+        for (n = 0; n < nr_chunks; n++) {
+            chunks[n].base = get_free_pages(PAGE_ORDER_2M, GFP_KERNEL);
+            if (!chunks[n].base)
+                break;
+        }
+
+        if (n == 0) {
+            warning("CPU[%u]: Unable to allocate trace buffer", cpu->id);
+            kfree(chunks);
+        }
+        else {
+            tb->cpu = cpu->id;
+            tb->nr_chunks = n;
+            tb->chunks = chunks;
+            trace_buf_reset(tb);
+        }
+
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first);
+
+    trace_enabled = true;
+}
+
+static struct {
+    uint8_t line[TRACE_HEX_LINE];
+    unsigned int len;
+} trace_hex;
+
+static void trace_hex_flush(void) {
+    char hex[TRACE_HEX_LINE * 2 + 1];
+
+    if (trace_hex.len == 0)
+        return;
+
+    for (unsigned int i = 0; i < trace_hex.len; i++)
+        snprintf(&hex[i * 2], 3, "%02x", trace_hex.line[i]);
+    printk("ktftrace:%s\n", hex);
+    trace_hex.len = 0;
+}
+
+/* Raw bytes to trace_port (e.g. the QEMU debug console), else hex lines via printk */
+static void trace_write(const void *buf, size_t len) {
+    const uint8_t *p = buf;
+
+    if (opt_trace_port) {
+        puts((io_port_t) opt_trace_port, buf, len);
+        return;
+    }
+
+    while (len--) {
+        trace_hex.line[trace_hex.len++] = *p++;
+        if (trace_hex.len == TRACE_HEX_LINE)
+            trace_hex_flush();
+    }
+}
+
+/* Write all buffers out in the binary format decoded by tools/trace/trace.py.
+ * Must not race with trace_event().
+ */
+void trace_dump(void) {
+    trace_header_t hdr = {.magic = TRACE_MAGIC, .version = TRACE_VERSION};
+    cpu_t *cpu, *first;
+    trace_buf_t *tb;
+
+    if (!trace_enabled)
+        return;
+
+    for_each_trace_buf (tb, cpu, first)
+        hdr.nr_cpus++;
+    hdr.tsc_khz = get_tsc_khz();
+
+    printk("Dumping trace buffers of %u CPUs\n", hdr.nr_cpus);
+    trace_write(&hdr, sizeof(hdr));
+
+    for_each_trace_buf (tb, cpu, first) {
+        trace_cpu_header_t cpu_hdr = {.cpu = tb->cpu, .dropped = tb->dropped};
+
+        for (unsigned int i = 0; i <= tb->chunk; i++)
+            cpu_hdr.size += trace_chunk_used(tb, i);
+        trace_write(&cpu_hdr, sizeof(cpu_hdr));
+
+        for (unsigned int i = 0; i <= tb->chunk; i++)
+            trace_write(tb->chunks[i].base, trace_chunk_used(tb, i));
+
+        if (tb->dropped > 0)
+            printk("CPU[%u]: %lu trace events dropped\n", tb->cpu, tb->dropped);
+    }
+    trace_hex_flush();
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <timer.h>
+#include <waitqueue.h>
+
+void init_wait_queue(wait_queue_t *wq) {
+    spin_lock_init(&wq->lock);
+    list_init(&wq->waiters);
+}
+
+static void wait_timeout(timer_t *timer) {
+    wait_entry_t *entry = timer->arg;
+
+    entry->ready = true;
+    if (entry->task)
+        task_wake(entry->task);
+}
+
+/* Queue the entry before the caller re-checks its wait condition, so that a
+ * concurrent wake_up() cannot be missed.
+ */
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *entry) {
+    unsigned long flags;
+
+    entry->task = get_current_task();
+    entry->woken = false;
+    entry->ready = false;
+    init_timer(&entry->timer, wait_timeout, entry);
+
+    flags = spin_lock_irqsave(&wq->lock);
+    list_add_tail(&entry->list, &wq->waiters);
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    /* Order the queueing against the condition check of the caller */
+    smp_mb();
+}
+
+/* Park the calling task until woken up or the TSC deadline has passed. The timeout
+ * uses a timer, when the local APIC timer runs. Otherwise the deadline is polled,
+ * yielding the CPU to other tasks in between.
+ */
+int wait_entry_sleep(wait_entry_t *entry, uint64_t deadline) {
+    if (deadline == WAIT_FOREVER) {
+        task_block(&entry->ready);
+        return 0;
+    }
+
+    if (entry->task && PERCPU_GET(apic_timer_enabled)) {
+        add_timer(&entry->timer, deadline);
+        task_block(&entry->ready);
+        del_timer(&entry->timer);
+    }
+    else {
+        while (!ACCESS_ONCE(entry->ready) && rdtsc() < deadline)
+            task_yield();
+    }
+
+    return ACCESS_ONCE(entry->woken) ? 0 : -ETIMEDOUT;
+}
+
+void finish_wait(wait_queue_t *wq, wait_entry_t *entry) {
+    unsigned long flags;
+
+    flags = spin_lock_irqsave(&wq->lock);
+    if (!entry->woken)
+        list_unlink(&entry->list);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/* Wake up to nr waiters in FIFO order. Returns the number of woken waiters */
+unsigned int wake_up_nr(wait_queue_t *wq, unsigned int nr) {
+    wait_entry_t *entry, *safe;
+    unsigned int woken = 0;
+    unsigned long flags;
+
+    flags = spin_lock_irqsave(&wq->lock);
+    list_for_each_entry_safe (entry, safe, &wq->waiters, list) {
+        task_t *task = entry->task;
+
+        if (woken == nr)
+            break;
+
+        list_unlink(&entry->list);
+        entry->woken = true;
+        entry->ready = true;
+        if (task)
+            task_wake(task);
+        woken++;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    return woken;
+}
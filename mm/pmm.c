@@ -425,32 +425,35 @@ static frame_t *_find_mfn_frame(list_head_t *list, mfn_t mfn, unsigned int order
 
 frame_t *find_free_mfn_frame(mfn_t mfn, unsigned int order) {
     frame_t *frame;
+    unsigned long flags;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_mfn_frame(free_frames, mfn, order);
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
 
 frame_t *find_busy_mfn_frame(mfn_t mfn, unsigned int order) {
     frame_t *frame;
+    unsigned long flags;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_mfn_frame(busy_frames, mfn, order);
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
 
 frame_t *find_mfn_frame(mfn_t mfn, unsigned int order) {
     frame_t *frame;
+    unsigned long flags;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_mfn_frame(busy_frames, mfn, order);
     if (!frame)
         frame = _find_mfn_frame(free_frames, mfn, order);
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
@@ -470,32 +473,35 @@ static frame_t *_find_paddr_frame(list_head_t *list, paddr_t paddr) {
 
 frame_t *find_free_paddr_frame(paddr_t paddr) {
     frame_t *frame;
+    unsigned long flags;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_paddr_frame(free_frames, paddr);
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
 
 frame_t *find_busy_paddr_frame(paddr_t paddr) {
     frame_t *frame;
+    unsigned long flags;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_paddr_frame(busy_frames, paddr);
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
 
 frame_t *find_paddr_frame(paddr_t paddr) {
     frame_t *frame;
+    unsigned long flags;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_paddr_frame(busy_frames, paddr);
     if (!frame)
         frame = _find_paddr_frame(free_frames, paddr);
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
@@ -599,7 +605,9 @@ static void try_create_4k_frames(void) {
  * This function does not split larger frames.
  */
 frame_t *get_free_frames_cond(free_frames_cond_t cb) {
-    spin_lock(&lock);
+    unsigned long flags;
+
+    flags = spin_lock_irqsave(&lock);
     try_create_4k_frames();
     for_each_order (order) {
         frame_t *frame;
@@ -607,23 +615,24 @@ frame_t *get_free_frames_cond(free_frames_cond_t cb) {
         list_for_each_entry (frame, &free_frames[order], list) {
             if (cb(frame)) {
                 reserve_frame(frame);
-                spin_unlock(&lock);
+                spin_unlock_irqrestore(&lock, flags);
                 return frame;
             }
         }
     }
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return NULL;
 }
 
 frame_t *get_free_frames(unsigned int order) {
     frame_t *frame;
+    unsigned long flags;
 
     if (order > MAX_PAGE_ORDER)
         return NULL;
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     if (order == PAGE_ORDER_4K)
         try_create_4k_frames();
 
@@ -631,24 +640,25 @@ frame_t *get_free_frames(unsigned int order) {
         BUG_ON(order == PAGE_ORDER_4K);
         frame = find_larger_frame(free_frames, order);
         if (!frame) {
-            spin_unlock(&lock);
+            spin_unlock_irqrestore(&lock, flags);
             return NULL;
         }
         split_frame(frame);
     }
 
     frame = reserve_frame(get_first_frame(free_frames, order));
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 
     return frame;
 }
 
 void put_free_frames(mfn_t mfn, unsigned int order) {
     frame_t *frame;
+    unsigned long flags;
 
     ASSERT(order <= MAX_PAGE_ORDER);
 
-    spin_lock(&lock);
+    flags = spin_lock_irqsave(&lock);
     frame = _find_mfn_frame(busy_frames, mfn, order);
     if (!frame) {
         warning("PMM: unable to find frame: %lx, order: %u among busy frames", mfn,
@@ -660,7 +670,7 @@ void put_free_frames(mfn_t mfn, unsigned int order) {
         merge_frames(frame);
 
 unlock:
-    spin_unlock(&lock);
+    spin_unlock_irqrestore(&lock, flags);
 }
 
 void map_frames_array(void) {
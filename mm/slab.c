@@ -185,6 +185,7 @@ static void *ktf_alloc(size_t size) {
     meta_slab_t *slab = NULL, *meta_slab = NULL;
     void *alloc = NULL, *free_page = NULL;
     int ret = 0;
+    unsigned long flags;
 
     if (size < SLAB_SIZE_MIN)
         size = SLAB_SIZE_MIN;
@@ -205,7 +206,7 @@ static void *ktf_alloc(size_t size) {
 
     dprintk("Alloc size %lu, powerof 2 size %lu, order %lu\n", size, size_power2,
             order_index);
-    spin_lock(&slab_mm_lock);
+    flags = spin_lock_irqsave(&slab_mm_lock);
     /* Go through list of meta_slab_t and try to allocate a free slab */
     list_for_each_entry (slab, &meta_slab_list[order_index], list) {
         alloc = slab_alloc(slab);
@@ -259,7 +260,7 @@ static void *ktf_alloc(size_t size) {
     alloc = slab_alloc(meta_slab);
 
 out:
-    spin_unlock(&slab_mm_lock);
+    spin_unlock_irqrestore(&slab_mm_lock, flags);
     return alloc;
 }
 
@@ -288,8 +289,9 @@ static void ktf_free(void *ptr) {
     int alloc_order;
     meta_slab_t *slab = NULL;
     meta_slab_t *meta_slab_page = NULL;
+    unsigned long flags;
 
-    spin_lock(&slab_mm_lock);
+    flags = spin_lock_irqsave(&slab_mm_lock);
     for (alloc_order = SLAB_ORDER_16; alloc_order < SLAB_ORDER_MAX; alloc_order++) {
         /* Go through list of meta_slab_t and try to allocate a free slab */
         list_for_each_entry (slab, &meta_slab_list[alloc_order], list) {
@@ -323,7 +325,7 @@ static void ktf_free(void *ptr) {
                         put_pages(meta_slab_page);
                     }
                 }
-                spin_unlock(&slab_mm_lock);
+                spin_unlock_irqrestore(&slab_mm_lock, flags);
                 return;
             }
         }
@@ -341,9 +343,10 @@ void kfree(void *ptr) {
 int init_slab(void) {
     int ret = 0;
     int i = 0;
+    unsigned long flags;
 
     printk("Initialize SLAB\n");
-    spin_lock(&slab_mm_lock);
+    flags = spin_lock_irqsave(&slab_mm_lock);
     memset(&meta_slab_list, 0, sizeof(meta_slab_list));
     memset(&meta_slab_page_list, 0, sizeof(meta_slab_page_list));
 
@@ -351,7 +354,7 @@ int init_slab(void) {
     for (i = SLAB_ORDER_16; i < SLAB_ORDER_MAX; i++) {
         list_init(&meta_slab_list[i]);
     }
-    spin_unlock(&slab_mm_lock);
+    spin_unlock_irqrestore(&slab_mm_lock, flags);
     dprintk("After initializing slab module\n");
     return ret;
 }
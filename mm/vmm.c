@@ -95,6 +95,7 @@ void *get_free_pages(unsigned int order, gfp_flags_t gfp_flags) {
     size_t size;
     unsigned long pt_flags;
     vmap_flags_t vmap_flags;
+    unsigned long flags;
 
     ASSERT(gfp_flags != GFP_NONE);
 
@@ -110,10 +111,10 @@ void *get_free_pages(unsigned int order, gfp_flags_t gfp_flags) {
     pt_flags = order_to_flags(order);
     vmap_flags = gfp_to_vmap_flags(gfp_flags);
 
-    spin_lock(&mmap_lock);
+    flags = spin_lock_irqsave(&mmap_lock);
     if (vmap_range(mfn_to_paddr(mfn), size, pt_flags, vmap_flags) == 0)
         va = gfp_mfn_to_virt(gfp_flags, mfn);
-    spin_unlock(&mmap_lock);
+    spin_unlock_irqrestore(&mmap_lock, flags);
 
     return va;
 }
@@ -121,9 +122,10 @@ void *get_free_pages(unsigned int order, gfp_flags_t gfp_flags) {
 void put_pages(void *page) {
     unsigned int order;
     mfn_t mfn;
+    unsigned long flags;
 
-    spin_lock(&mmap_lock);
+    flags = spin_lock_irqsave(&mmap_lock);
     BUG_ON(vunmap_kern(page, &mfn, &order));
-    spin_unlock(&mmap_lock);
+    spin_unlock_irqrestore(&mmap_lock, flags);
     put_free_frames(mfn, order);
 }
\ No newline at end of file
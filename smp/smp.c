@@ -33,6 +33,7 @@
 #include <sched.h>
 #include <setup.h>
 #include <traps.h>
+#include <tsc.h>
 
 #include <mm/vmm.h>
 
@@ -50,6 +51,7 @@ cr3_t __data_init ap_cr3;
 
 void __noreturn ap_startup(void) {
     WRITE_SP(ap_new_sp);
+    init_pat();
     setup_tlb_global();
 
     cpu_t *cpu = get_cpu(ap_cpuid);
@@ -68,6 +70,8 @@ void __noreturn ap_startup(void) {
     ap_callin = true;
     smp_wmb();
 
+    tsc_sync_target(cpu);
+
     while (true)
         run_tasks(cpu);
 
@@ -111,6 +115,8 @@ static __text_init void boot_cpu(cpu_t *cpu) {
     while (!ap_callin)
         cpu_relax();
 
+    tsc_sync_source(cpu);
+
     dprintk("AP: %u Done \n", cpu->id);
 }
 
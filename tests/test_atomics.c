@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <atomic.h>
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <start_barrier.h>
+
+#include <smp/smp.h>
+
+#define NR_ITERATIONS 100000
+#define NR_NODES      64
+#define QUEUE_SIZE    256
+#define QUEUE_MASK    (QUEUE_SIZE - 1)
+
+/* Treiber stack, the head tag counts updates to defeat ABA */
+struct lf_node {
+    struct lf_node *next;
+    unsigned long owner;
+};
+
+static struct lf_node nodes[NR_NODES];
+static atomic128_t stack_head;
+
+static void lf_push(struct lf_node *node) {
+    atomic128_t old = atomic128_read(&stack_head), new;
+
+    do {
+        node->next = _ptr(old.lo);
+        new.lo = _ul(node);
+        new.hi = old.hi + 1;
+    } while (!atomic128_try_cmpxchg(&stack_head, &old, new));
+}
+
+/* Nodes are never freed, reading next of a node popped meanwhile is harmless */
+static struct lf_node *lf_pop(void) {
+    atomic128_t old = atomic128_read(&stack_head), new;
+
+    do {
+        if (!old.lo)
+            return NULL;
+        new.lo = _ul(ACCESS_ONCE(((struct lf_node *) _ptr(old.lo))->next));
+        new.hi = old.hi + 1;
+    } while (!atomic128_try_cmpxchg(&stack_head, &old, new));
+
+    return _ptr(old.lo);
+}
+
+/* Bounded MPMC queue: a cell's sequence tells whose turn it is */
+struct lf_cell {
+    uint64_t seq;
+    uint64_t data;
+};
+
+static struct lf_cell cells[QUEUE_SIZE];
+static uint64_t enqueue_pos __aligned(64);
+static uint64_t dequeue_pos __aligned(64);
+
+static bool lf_enqueue(uint64_t data) {
+    uint64_t pos = load_relaxed(&enqueue_pos);
+    struct lf_cell *cell;
+
+    for (;;) {
+        int64_t diff;
+
+        cell = &cells[pos & QUEUE_MASK];
+        diff = (int64_t) load_acquire(&cell->seq) - (int64_t) pos;
+        if (diff == 0) {
+            if (try_cmpxchg(&enqueue_pos, &pos, pos + 1))
+                break;
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = load_relaxed(&enqueue_pos);
+        }
+    }
+
+    cell->data = data;
+    store_release(&cell->seq, pos + 1);
+    return true;
+}
+
+static bool lf_dequeue(uint64_t *data) {
+    uint64_t pos = load_relaxed(&dequeue_pos);
+    struct lf_cell *cell;
+
+    for (;;) {
+        int64_t diff;
+
+        cell = &cells[pos & QUEUE_MASK];
+        diff = (int64_t) load_acquire(&cell->seq) - (int64_t)(pos + 1);
+        if (diff == 0) {
+            if (try_cmpxchg(&dequeue_pos, &pos, pos + 1))
+                break;
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = load_relaxed(&dequeue_pos);
+        }
+    }
+
+    *data = cell->data;
+    store_release(&cell->seq, pos + QUEUE_SIZE);
+    return true;
+}
+
+static start_barrier_t barrier;
+static bool has_cx16;
+static atomic64_t enqueue_sum, dequeue_sum;
+static atomic64_t stack_errors;
+static atomic_t cpus_seen;
+
+static unsigned long atomics_func(void *unused) {
+    unsigned int cpu = smp_processor_id();
+    uint64_t enq = 0, deq = 0, errors = 0;
+
+    start_barrier_wait(&barrier);
+
+    atomic_inc(&cpus_seen);
+
+    for (unsigned int i = 0; i < NR_ITERATIONS; i++) {
+        uint64_t val = ((uint64_t) cpu << 32) | i;
+
+        while (!lf_enqueue(val))
+            cpu_relax();
+        enq += val;
+
+        while (!lf_dequeue(&val))
+            cpu_relax();
+        deq += val;
+
+        if (has_cx16) {
+            struct lf_node *node = lf_pop();
+
+            if (!node)
+                continue;
+
+            /* Nobody else may own a node while it is off the stack */
+            if (xchg(&node->owner, cpu + 1) != 0)
+                errors++;
+            store_release(&node->owner, 0);
+            lf_push(node);
+        }
+    }
+
+    atomic64_add(&enqueue_sum, enq);
+    atomic64_add(&dequeue_sum, deq);
+    atomic64_add(&stack_errors, errors);
+
+    return 0;
+}
+
+/* All CPUs run lock-free stack and queue operations against each other. No node
+ * may be lost, duplicated or owned twice, and every enqueued value is dequeued.
+ */
+int test_atomics(void *unused) {
+    unsigned int nr_cpus, nr_nodes = 0;
+    uint64_t start, cycles;
+    struct lf_node *node;
+    cpumask_t cpus;
+
+    get_cpus_mask(&cpus);
+    nr_cpus = cpumask_weight(&cpus);
+
+    has_cx16 = cpu_has_cmpxchg16b();
+    if (!has_cx16)
+        printk("%s: No cmpxchg16b. Skipping lock-free stack test.\n", __func__);
+
+    memset(&stack_head, 0, sizeof(stack_head));
+    memset(nodes, 0, sizeof(nodes));
+    for (unsigned int i = 0; has_cx16 && i < NR_NODES; i++)
+        lf_push(&nodes[i]);
+
+    for (unsigned int i = 0; i < QUEUE_SIZE; i++)
+        cells[i].seq = i;
+    enqueue_pos = dequeue_pos = 0;
+
+    atomic_set(&enqueue_sum, 0);
+    atomic_set(&dequeue_sum, 0);
+    atomic_set(&stack_errors, 0);
+    atomic_set(&cpus_seen, 0);
+    start_barrier_init(&barrier, nr_cpus);
+
+    start = rdtsc();
+    BUG_ON(schedule_on_all_cpus("atomics", atomics_func, NULL));
+    execute_tasks();
+    cycles = rdtsc() - start;
+
+    while (has_cx16 && (node = lf_pop()))
+        nr_nodes++;
+
+    printk("%s,cpus,iterations,cycles,queue_sum_diff,stack_nodes,stack_errors,"
+           "cpus_seen\n",
+           __func__);
+    printk("%s,%u,%u,%lu,%ld,%u,%ld,%d\n", __func__, nr_cpus, NR_ITERATIONS, cycles,
+           atomic_read(&enqueue_sum) - atomic_read(&dequeue_sum), nr_nodes,
+           atomic_read(&stack_errors), atomic_read(&cpus_seen));
+
+    if (atomic_read(&enqueue_sum) != atomic_read(&dequeue_sum) ||
+        atomic_read(&stack_errors) || (has_cx16 && nr_nodes != NR_NODES) ||
+        atomic_read(&cpus_seen) != (int) nr_cpus)
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <setup.h>
+#include <time.h>
+
+#define NR_COROUTINES 32
+#define NR_YIELDS     1000
+#define NR_SLEEPERS   8
+#define SLEEP_MS      50
+
+static unsigned long last_coroutine, nr_switches;
+
+static unsigned long yield_task_func(void *arg) {
+    for (unsigned int i = 0; i < NR_YIELDS; i++) {
+        if (last_coroutine != _ul(arg))
+            nr_switches++;
+        last_coroutine = _ul(arg);
+        task_yield();
+    }
+
+    return 0;
+}
+
+static unsigned long sleep_task_func(void *unused) {
+    return task_sleep_ms(SLEEP_MS);
+}
+
+static uint64_t run_coroutines(cpu_t *cpu, task_func_t func, unsigned int n) {
+    uint64_t start;
+
+    for (unsigned int i = 0; i < n; i++) {
+        task_t *task = new_coroutine_task("coroutine", func, _ptr(i + 1));
+
+        BUG_ON(!task);
+        schedule_task(task, cpu);
+    }
+
+    start = rdtsc();
+    execute_tasks();
+    return rdtsc() - start;
+}
+
+int test_coroutines(void *unused) {
+    cpu_t *cpu = get_bsp_cpu();
+    uint64_t yield_cycles, sleep_cycles;
+    time_t sleep_ticks;
+
+    last_coroutine = nr_switches = 0;
+    yield_cycles = run_coroutines(cpu, yield_task_func, NR_COROUTINES);
+
+    printk("%s,coroutines,yields,switches,cycles_per_yield\n", __func__);
+    printk("%s,%u,%u,%lu,%lu\n", __func__, NR_COROUTINES, NR_YIELDS, nr_switches,
+           yield_cycles / (NR_COROUTINES * NR_YIELDS));
+
+    /* Every yield has to hand the CPU over to another coroutine */
+    if (nr_switches < NR_COROUTINES * NR_YIELDS) {
+        printk("%s: Coroutines did not take turns\n", __func__);
+        return -1;
+    }
+
+    if (!PERCPU_GET(apic_timer_enabled) && !boot_flags.timer_global) {
+        printk("%s: No timer available. Skipping sleep test.\n", __func__);
+        return 0;
+    }
+
+    sleep_ticks = get_timer_ticks();
+    sleep_cycles = run_coroutines(cpu, sleep_task_func, NR_SLEEPERS);
+    sleep_ticks = get_timer_ticks() - sleep_ticks;
+
+    printk("%s,sleepers,sleep_ms,elapsed_cycles,elapsed_ticks\n", __func__);
+    printk("%s,%u,%u,%lu,%lu\n", __func__, NR_SLEEPERS, SLEEP_MS, sleep_cycles,
+           sleep_ticks);
+
+    /* Sleeping coroutines must not hold up each other */
+    if (sleep_ticks >= NR_SLEEPERS * SLEEP_MS) {
+        printk("%s: Sleepers did not overlap\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
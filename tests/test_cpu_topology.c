@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+
+#include <smp/smp.h>
+
+#define MAX_PLACED_TASKS 64
+
+static unsigned int placed_cpus[MAX_PLACED_TASKS];
+
+static unsigned long record_cpu_func(void *arg) {
+    *(unsigned int *) arg = smp_processor_id();
+    return 0;
+}
+
+static inline bool same_core(const cpu_t *a, const cpu_t *b) {
+    return a->topology.package == b->topology.package &&
+           a->topology.core == b->topology.core;
+}
+
+/* Number of distinct physical cores among the CPUs */
+static unsigned int count_cores(cpu_t *cpus[], unsigned int n) {
+    unsigned int nr_cores = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int j;
+
+        for (j = 0; j < i && !same_core(cpus[i], cpus[j]); j++)
+            ;
+        if (j == i)
+            nr_cores++;
+    }
+
+    return nr_cores;
+}
+
+/* Returns the number of distinct cores the tasks ran on */
+static unsigned int run_placement(cpu_placement_t placement, unsigned int nr_tasks) {
+    static task_t *tasks[MAX_PLACED_TASKS];
+    static cpu_t *cpus[MAX_PLACED_TASKS];
+
+    for (unsigned int i = 0; i < nr_tasks; i++) {
+        tasks[i] = new_kernel_task("placed", record_cpu_func, &placed_cpus[i]);
+        BUG_ON(!tasks[i]);
+    }
+
+    BUG_ON(schedule_tasks_placed(tasks, nr_tasks, placement));
+    execute_tasks();
+
+    for (unsigned int i = 0; i < nr_tasks; i++) {
+        cpu_t *cpu = cpus[i] = get_cpu(placed_cpus[i]);
+
+        printk("%s,%s,%u,%u,%u,%u,%u\n", __func__,
+               placement == CPU_PLACEMENT_SPREAD ? "spread" : "pack", i, cpu->id,
+               cpu->topology.package, cpu->topology.core, cpu->topology.thread);
+    }
+
+    return count_cores(cpus, nr_tasks);
+}
+
+/* Half as many tasks as CPUs: spreading must use distinct cores (as far as there
+ * are enough), packing must fill the SMT siblings of a core before the next one.
+ */
+int test_cpu_topology(void *unused) {
+    static cpu_t *all_cpus[MAX_CPUS];
+    cpu_t *first = get_next_cpu(NULL), *cpu = first;
+    unsigned int nr_cpus = 0, nr_cores, nr_smt, nr_tasks, spread_cores, pack_cores;
+    cpumask_t siblings;
+
+    do {
+        all_cpus[nr_cpus++] = cpu;
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first && nr_cpus < ARRAY_SIZE(all_cpus));
+    nr_cores = count_cores(all_cpus, nr_cpus);
+    nr_tasks = min(max(nr_cpus / 2, 1U), _u(MAX_PLACED_TASKS));
+
+    get_cpu_siblings(get_bsp_cpu(), &siblings);
+    nr_smt = max(cpumask_weight(&siblings), 1U);
+    printk("%s: %u CPUs, %u cores, BSP has %u SMT siblings (itself included)\n",
+           __func__, nr_cpus, nr_cores, nr_smt);
+
+    printk("%s,placement,task,cpu,package,core,thread\n", __func__);
+    spread_cores = run_placement(CPU_PLACEMENT_SPREAD, nr_tasks);
+    pack_cores = run_placement(CPU_PLACEMENT_PACK, nr_tasks);
+
+    if (spread_cores != min(nr_tasks, nr_cores)) {
+        printk("%s: Spread placement used %u cores, expected %u\n", __func__,
+               spread_cores, min(nr_tasks, nr_cores));
+        return -1;
+    }
+
+    /* Assumes all cores have as many SMT siblings as the BSP's */
+    if (nr_cores * nr_smt == nr_cpus && pack_cores != div_round_up(nr_tasks, nr_smt)) {
+        printk("%s: Pack placement used %u cores, expected %u\n", __func__, pack_cores,
+               div_round_up(nr_tasks, nr_smt));
+        return -1;
+    }
+
+    return 0;
+}
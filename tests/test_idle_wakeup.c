@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <idle.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+
+#define WAKEUP_ROUNDS      16
+#define IDLE_SETTLE_CYCLES (1000 * 1000)
+
+static unsigned long stamp_task_func(void *arg) {
+    ACCESS_ONCE(*(uint64_t *) arg) = rdtsc();
+    return 0;
+}
+
+/* Cycles between unblocking an idle AP and its task starting. The task stamps
+ * the first observation of the wakeup, later idle waits of the AP do not count.
+ */
+static void measure_wakeup_latency(cpu_t *cpu, idle_mode_t mode) {
+    uint64_t min = ~_U64(0), max = 0, total = 0;
+    unsigned int samples = 0;
+
+    for (unsigned int i = 0; i < WAKEUP_ROUNDS; i++) {
+        uint64_t start, latency, stamp = 0;
+        task_t *task = new_kernel_task("wakeup", stamp_task_func, &stamp);
+
+        BUG_ON(!task);
+        schedule_task(task, cpu);
+
+        /* Let the AP settle in its idle wait */
+        wait_cycles(IDLE_SETTLE_CYCLES);
+
+        start = rdtsc();
+        execute_tasks();
+        if (ACCESS_ONCE(stamp) < start)
+            continue;
+
+        latency = ACCESS_ONCE(stamp) - start;
+        min = min(min, latency);
+        max = max(max, latency);
+        total += latency;
+        samples++;
+    }
+
+    if (samples == 0) {
+        printk("%s,%s,%u,,,\n", __func__, idle_mode_name(mode), cpu->id);
+        return;
+    }
+
+    printk("%s,%s,%u,%lu,%lu,%lu\n", __func__, idle_mode_name(mode), cpu->id, min,
+           total / samples, max);
+}
+
+int test_idle_wakeup(void *unused) {
+    idle_mode_t saved_mode = idle_mode;
+    cpu_t *cpu = get_next_cpu(get_bsp_cpu());
+
+    if (!cpu || is_cpu_bsp(cpu)) {
+        printk("%s: At least one AP is required. Skipping.\n", __func__);
+        return 0;
+    }
+
+    printk("measure_wakeup_latency,mode,cpu,min_cycles,avg_cycles,max_cycles\n");
+    for (idle_mode_t mode = IDLE_MODE_POLL; mode <= IDLE_MODE_MWAIT; mode++) {
+        if (!set_idle_mode(mode))
+            continue;
+        measure_wakeup_latency(cpu, mode);
+    }
+
+    set_idle_mode(saved_mode);
+    return 0;
+}
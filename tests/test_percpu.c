@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <atomic.h>
+#include <console.h>
+#include <cpu.h>
+#include <errno.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <sched.h>
+#include <start_barrier.h>
+
+#include <smp/smp.h>
+
+#define NR_INCREMENTS 100000
+
+DEFINE_PERCPU(unsigned long, test_counter);
+
+static percpu_off_t dyn_counter;
+static atomic64_t shared_counter;
+static start_barrier_t barrier;
+static uint64_t percpu_cycles[MAX_CPUS], dyn_cycles[MAX_CPUS], shared_cycles[MAX_CPUS];
+
+static unsigned long percpu_func(void *unused) {
+    unsigned int cpu = smp_processor_id();
+    uint64_t start, cycles[3];
+
+    start = start_barrier_wait(&barrier);
+    for (unsigned int i = 0; i < NR_INCREMENTS; i++)
+        this_cpu_inc(test_counter);
+    cycles[0] = rdtsc() - start;
+
+    start = rdtsc();
+    for (unsigned int i = 0; i < NR_INCREMENTS; i++)
+        percpu_add(unsigned long, dyn_counter, 1);
+    cycles[1] = rdtsc() - start;
+
+    start = rdtsc();
+    for (unsigned int i = 0; i < NR_INCREMENTS; i++)
+        atomic64_inc(&shared_counter);
+    cycles[2] = rdtsc() - start;
+
+    if (cpu < MAX_CPUS) {
+        percpu_cycles[cpu] = cycles[0];
+        dyn_cycles[cpu] = cycles[1];
+        shared_cycles[cpu] = cycles[2];
+    }
+
+    return 0;
+}
+
+static uint64_t max_cycles(const uint64_t *cycles) {
+    uint64_t max = 0;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++)
+        max = max(max, cycles[cpu]);
+
+    return max;
+}
+
+/* Every CPU bumps a static and a dynamically allocated per-CPU counter, then
+ * a shared atomic one. The per-CPU totals must add up to the same value.
+ */
+int test_percpu(void *unused) {
+    cpu_t *first = get_next_cpu(NULL), *cpu = first;
+    unsigned long static_total = 0, dyn_total = 0;
+    unsigned int nr_cpus;
+    cpumask_t cpus;
+
+    get_cpus_mask(&cpus);
+    nr_cpus = cpumask_weight(&cpus);
+
+    dyn_counter = alloc_percpu(sizeof(unsigned long));
+    if (!dyn_counter) {
+        printk("%s: alloc_percpu() failed\n", __func__);
+        return -ENOMEM;
+    }
+
+    do {
+        *per_cpu_ptr(test_counter, cpu->percpu) = 0;
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first);
+    atomic_set(&shared_counter, 0);
+    memset(percpu_cycles, 0, sizeof(percpu_cycles));
+    memset(dyn_cycles, 0, sizeof(dyn_cycles));
+    memset(shared_cycles, 0, sizeof(shared_cycles));
+    start_barrier_init(&barrier, nr_cpus);
+
+    BUG_ON(schedule_on_all_cpus("percpu", percpu_func, NULL));
+    execute_tasks();
+
+    cpu = first;
+    do {
+        static_total += *per_cpu_ptr(test_counter, cpu->percpu);
+        dyn_total += *(unsigned long *) percpu_ptr(cpu->percpu, dyn_counter);
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first);
+    free_percpu(dyn_counter, sizeof(unsigned long));
+
+    printk("%s,counter,cpus,total,max_cpu_cycles\n", __func__);
+    printk("%s,static,%u,%lu,%lu\n", __func__, nr_cpus, static_total,
+           max_cycles(percpu_cycles));
+    printk("%s,dynamic,%u,%lu,%lu\n", __func__, nr_cpus, dyn_total,
+           max_cycles(dyn_cycles));
+    printk("%s,shared,%u,%ld,%lu\n", __func__, nr_cpus, atomic_read(&shared_counter),
+           max_cycles(shared_cycles));
+
+    if (static_total != dyn_total || (long) static_total != atomic_read(&shared_counter))
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cmdline.h>
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <time.h>
+
+#define HOG_TICKS 200
+/* The probe has to start within a few quanta of the hog */
+#define QUANTUM_SLACK 3
+
+static time_t hog_start, probe_start;
+
+static unsigned long hog_task_func(void *unused) {
+    time_t end;
+
+    hog_start = get_local_ticks();
+    end = hog_start + HOG_TICKS;
+    while (get_local_ticks() < end)
+        cpu_relax();
+
+    return 0;
+}
+
+static unsigned long probe_task_func(void *unused) {
+    probe_start = get_local_ticks();
+    return 0;
+}
+
+/* Ticks between a CPU hog getting the CPU and a task queued behind it starting */
+static time_t measure_probe_latency(cpu_t *cpu, bool preempt) {
+    task_t *hog = new_kernel_task("hog", hog_task_func, NULL);
+    task_t *probe = new_kernel_task("probe", probe_task_func, NULL);
+
+    BUG_ON(!hog || !probe);
+    opt_sched_preempt = preempt;
+
+    schedule_task(hog, cpu);
+    schedule_task(probe, cpu);
+    execute_tasks();
+
+    return probe_start - hog_start;
+}
+
+int test_preemption(void *unused) {
+    cpu_t *cpu = get_next_cpu(get_bsp_cpu());
+    time_t static_ticks, preempt_ticks;
+
+    if (!opt_sched_preempt) {
+        printk("%s: Preemption disabled (sched_preempt). Skipping.\n", __func__);
+        return 0;
+    }
+
+    static_ticks = measure_probe_latency(cpu, false);
+    preempt_ticks = measure_probe_latency(cpu, true);
+
+    printk("%s,cpu,quantum,static_ticks,preempt_ticks\n", __func__);
+    printk("%s,%u,%lu,%lu,%lu\n", __func__, cpu->id, opt_sched_quantum, static_ticks,
+           preempt_ticks);
+
+    if (preempt_ticks >= static_ticks ||
+        preempt_ticks > (time_t) (QUANTUM_SLACK * opt_sched_quantum)) {
+        printk("%s: The probe did not preempt the hog\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
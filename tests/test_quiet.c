@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <quiet.h>
+
+#define QUIET_SAMPLES     1000
+#define QUIET_LOOP_CYCLES 100000
+
+/* Spread of a fixed busy loop's duration. Interrupts hitting a sample inflate
+ * the maximum.
+ */
+static void measure_loops(uint64_t *min_cycles, uint64_t *max_cycles) {
+    *min_cycles = ULONG_MAX;
+    *max_cycles = 0;
+
+    for (unsigned int i = 0; i < QUIET_SAMPLES; i++) {
+        uint64_t start = rdtscp();
+
+        wait_cycles(QUIET_LOOP_CYCLES);
+        start = rdtscp() - start;
+        *min_cycles = min(*min_cycles, start);
+        *max_cycles = max(*max_cycles, start);
+    }
+}
+
+int test_quiet(void *unused) {
+    uint64_t noisy_min, noisy_max, quiet_min, quiet_max;
+    unsigned long noisy_irqs, quiet_irqs;
+    quiet_window_t window;
+    cpumask_t cpus;
+
+    noisy_irqs = PERCPU_GET(irq_count);
+    measure_loops(&noisy_min, &noisy_max);
+    noisy_irqs = PERCPU_GET(irq_count) - noisy_irqs;
+
+    /* Stop the timers of all CPUs, keep no IOAPIC line */
+    get_cpus_mask(&cpus);
+    if (quiet_enter(&window, &cpus, NULL, 0) < 0)
+        return -1;
+
+    measure_loops(&quiet_min, &quiet_max);
+    quiet_irqs = quiet_exit(&window);
+
+    printk("%s,mode,irqs,min_cycles,max_cycles\n", __func__);
+    printk("%s,noisy,%lu,%lu,%lu\n", __func__, noisy_irqs, noisy_min, noisy_max);
+    printk("%s,quiet,%lu,%lu,%lu\n", __func__, quiet_irqs, quiet_min, quiet_max);
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <rwlock.h>
+#include <sched.h>
+#include <start_barrier.h>
+
+#include <smp/smp.h>
+
+#define WRITE_ITERATIONS 1000
+#define READ_PAUSE       64 /* Gives the (not preferred) writer a chance */
+
+struct pair {
+    volatile unsigned long a;
+    volatile unsigned long b;
+};
+
+static rwlock_t rwlock = RWLOCK_INIT;
+static struct pair rw_data;
+static seqlock_t seqlock = SEQLOCK_INIT;
+static struct pair seq_data;
+
+static start_barrier_t barrier;
+static unsigned int writer_cpu;
+static volatile bool writer_done;
+static atomic64_t nr_reads;
+static atomic64_t nr_errors;
+
+static void write_pairs(bool use_seqlock) {
+    for (unsigned int i = 0; i < WRITE_ITERATIONS; i++) {
+        if (use_seqlock) {
+            write_seqlock(&seqlock);
+            seq_data.a++;
+            seq_data.b++;
+            write_sequnlock(&seqlock);
+        }
+        else {
+            write_lock(&rwlock);
+            rw_data.a++;
+            rw_data.b++;
+            write_unlock(&rwlock);
+        }
+        cpu_relax();
+    }
+    writer_done = true;
+}
+
+/* Readers must never observe a torn pair, whatever the writer does meanwhile */
+static void read_pairs(bool use_seqlock) {
+    unsigned long reads = 0, errors = 0, a, b;
+
+    while (!ACCESS_ONCE(writer_done)) {
+        if (use_seqlock) {
+            unsigned int seq;
+
+            do {
+                seq = read_seqbegin(&seqlock);
+                a = seq_data.a;
+                b = seq_data.b;
+            } while (read_seqretry(&seqlock, seq));
+        }
+        else {
+            read_lock(&rwlock);
+            a = rw_data.a;
+            b = rw_data.b;
+            read_unlock(&rwlock);
+        }
+
+        if (a != b)
+            errors++;
+        reads++;
+
+        for (unsigned int i = 0; i < READ_PAUSE; i++)
+            cpu_relax();
+    }
+
+    atomic64_add_return(&nr_reads, reads);
+    atomic64_add_return(&nr_errors, errors);
+}
+
+static unsigned long rw_func(void *arg) {
+    bool use_seqlock = !!arg;
+
+    start_barrier_wait(&barrier);
+    if (smp_processor_id() == writer_cpu)
+        write_pairs(use_seqlock);
+    else
+        read_pairs(use_seqlock);
+
+    return 0;
+}
+
+/* One CPU keeps updating a pair of counters, all other CPUs read it consistently */
+int test_rwlock(void *unused) {
+    unsigned int nr_cpus;
+    cpumask_t cpus;
+    int rc = 0;
+
+    get_cpus_mask(&cpus);
+    nr_cpus = cpumask_weight(&cpus);
+    writer_cpu = cpumask_first(&cpus);
+
+    printk("%s,lock,cpus,writes,reads,errors\n", __func__);
+
+    for (unsigned int use_seqlock = 0; use_seqlock < 2; use_seqlock++) {
+        writer_done = false;
+        atomic_set(&nr_reads, 0);
+        atomic_set(&nr_errors, 0);
+        start_barrier_init(&barrier, nr_cpus);
+
+        BUG_ON(schedule_on_all_cpus("rwlock", rw_func, _ptr(use_seqlock)));
+        execute_tasks();
+
+        printk("%s,%s,%u,%u,%ld,%ld\n", __func__, use_seqlock ? "seqlock" : "rwlock",
+               nr_cpus, WRITE_ITERATIONS, atomic_read(&nr_reads),
+               atomic_read(&nr_errors));
+
+        /* Torn reads mean a broken rwlock or seqlock */
+        if (atomic_read(&nr_errors) != 0)
+            rc = -1;
+    }
+
+    return rc;
+}
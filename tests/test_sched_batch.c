@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+
+#define NR_BATCH_TASKS 32
+
+static unsigned long nop_func(void *unused) {
+    return 0;
+}
+
+/* Cycles it takes to schedule NR_BATCH_TASKS tasks on every CPU */
+static uint64_t fan_out(bool batch) {
+    static task_t *tasks[NR_BATCH_TASKS];
+    cpu_t *first_cpu = get_next_cpu(NULL), *cpu = first_cpu;
+    uint64_t cycles = 0, start;
+
+    do {
+        for (unsigned int i = 0; i < NR_BATCH_TASKS; i++) {
+            tasks[i] = new_kernel_task("batch", nop_func, NULL);
+            BUG_ON(!tasks[i]);
+        }
+
+        start = rdtsc();
+        if (batch) {
+            schedule_tasks_batch(tasks, NR_BATCH_TASKS, cpu);
+        }
+        else {
+            for (unsigned int i = 0; i < NR_BATCH_TASKS; i++)
+                schedule_task(tasks[i], cpu);
+        }
+        cycles += rdtsc() - start;
+
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first_cpu);
+
+    execute_tasks();
+    return cycles;
+}
+
+int test_sched_batch(void *unused) {
+    uint64_t single, batch, broadcast;
+
+    single = fan_out(false);
+    batch = fan_out(true);
+
+    broadcast = rdtsc();
+    BUG_ON(schedule_on_all_cpus("broadcast", nop_func, NULL));
+    broadcast = rdtsc() - broadcast;
+    execute_tasks();
+
+    printk("%s,cpus,tasks_per_cpu,single_cycles,batch_cycles,all_cpus_cycles\n",
+           __func__);
+    printk("%s,%u,%u,%lu,%lu,%lu\n", __func__, get_nr_cpus(), NR_BATCH_TASKS, single,
+           batch, broadcast);
+
+    return 0;
+}
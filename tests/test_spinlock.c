@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <spinlock.h>
+#include <start_barrier.h>
+
+#include <smp/smp.h>
+
+#define LOCK_ITERATIONS 10000
+
+static tas_lock_t tas = TAS_LOCK_INIT;
+static tas_lock_t ttas = TAS_LOCK_INIT;
+static ticket_lock_t ticket = TICKET_LOCK_INIT;
+static mcs_lock_t mcs = MCS_LOCK_INIT;
+
+static void tas_acquire(void) {
+    tas_lock(&tas);
+}
+
+static void tas_release(void) {
+    tas_unlock(&tas);
+}
+
+static void ttas_acquire(void) {
+    ttas_lock(&ttas);
+}
+
+static void ttas_release(void) {
+    tas_unlock(&ttas);
+}
+
+static void ticket_acquire(void) {
+    ticket_lock(&ticket);
+}
+
+static void ticket_release(void) {
+    ticket_unlock(&ticket);
+}
+
+static void mcs_acquire(void) {
+    mcs_lock(&mcs);
+}
+
+static void mcs_release(void) {
+    mcs_unlock(&mcs);
+}
+
+struct lock_variant {
+    const char *name;
+    void (*acquire)(void);
+    void (*release)(void);
+};
+
+static const struct lock_variant variants[] = {
+    {"tas", tas_acquire, tas_release},
+    {"ttas", ttas_acquire, ttas_release},
+    {"ticket", ticket_acquire, ticket_release},
+    {"mcs", mcs_acquire, mcs_release},
+};
+
+static const struct lock_variant *variant;
+static start_barrier_t barrier;
+static volatile unsigned long shared_counter;
+static uint64_t cpu_cycles[MAX_CPUS];
+
+static unsigned long contend_func(void *unused) {
+    unsigned int cpu = smp_processor_id();
+    uint64_t start = start_barrier_wait(&barrier);
+
+    for (unsigned int i = 0; i < LOCK_ITERATIONS; i++) {
+        variant->acquire();
+        shared_counter++;
+        variant->release();
+    }
+
+    if (cpu < MAX_CPUS)
+        cpu_cycles[cpu] = rdtsc() - start;
+    return 0;
+}
+
+/* All CPUs hammer one lock with a tiny critical section. The spread between the
+ * fastest and the slowest CPU shows how (un)fair the lock is.
+ */
+int test_spinlock(void *unused) {
+    unsigned int nr_cpus;
+    int rc = 0;
+    cpumask_t cpus;
+
+    get_cpus_mask(&cpus);
+    nr_cpus = cpumask_weight(&cpus);
+
+    printk("%s: spinlock_t is %s\n", __func__, SPINLOCK_NAME);
+    printk("%s,lock,cpus,cycles_per_op,fastest_cpu_cycles,slowest_cpu_cycles,errors\n",
+           __func__);
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(variants); i++) {
+        uint64_t fastest = ULONG_MAX, slowest = 0;
+
+        variant = &variants[i];
+        shared_counter = 0;
+        memset(cpu_cycles, 0, sizeof(cpu_cycles));
+        start_barrier_init(&barrier, nr_cpus);
+
+        BUG_ON(schedule_on_all_cpus("lock_contend", contend_func, NULL));
+        execute_tasks();
+
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (!cpu_cycles[cpu])
+                continue;
+            fastest = min(fastest, cpu_cycles[cpu]);
+            slowest = max(slowest, cpu_cycles[cpu]);
+        }
+
+        printk("%s,%s,%u,%lu,%lu,%lu,%lu\n", __func__, variant->name, nr_cpus,
+               slowest / (nr_cpus * LOCK_ITERATIONS), fastest, slowest,
+               nr_cpus * LOCK_ITERATIONS - shared_counter);
+
+        /* Lost updates mean broken mutual exclusion */
+        if (shared_counter != nr_cpus * LOCK_ITERATIONS)
+            rc = -1;
+    }
+
+    return rc;
+}
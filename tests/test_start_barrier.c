@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <sched.h>
+#include <start_barrier.h>
+
+#include <smp/smp.h>
+
+static start_barrier_t barrier;
+static start_barrier_stats_t stats;
+static uint64_t unsynced_start[MAX_CPUS];
+
+static unsigned long unsynced_func(void *unused) {
+    unsigned int cpu = smp_processor_id();
+
+    if (cpu < MAX_CPUS)
+        unsynced_start[cpu] = rdtsc() - PERCPU_GET(tsc_offset);
+    return 0;
+}
+
+static unsigned long synced_func(void *unused) {
+    uint64_t start = start_barrier_wait(&barrier);
+
+    start_barrier_record(&stats, &barrier, start);
+    return 0;
+}
+
+/* Start spread of one task per CPU, as execute_tasks() releases them, compared
+ * with a start barrier rendezvous.
+ */
+int test_start_barrier(void *unused) {
+    uint64_t first = ULONG_MAX, last = 0, unsynced_spread, synced_spread;
+    cpumask_t cpus;
+
+    BUG_ON(schedule_on_all_cpus("unsynced", unsynced_func, NULL));
+    execute_tasks();
+
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        if (!unsynced_start[i])
+            continue;
+        first = min(first, unsynced_start[i]);
+        last = max(last, unsynced_start[i]);
+    }
+    unsynced_spread = last - first;
+    printk("%s: Without barrier: spread between CPUs %lu cycles\n", __func__,
+           unsynced_spread);
+
+    get_cpus_mask(&cpus);
+    start_barrier_init(&barrier, cpumask_weight(&cpus));
+    BUG_ON(schedule_on_all_cpus("synced", synced_func, NULL));
+    execute_tasks();
+
+    synced_spread = start_barrier_report(&stats);
+
+    if (cpumask_weight(&cpus) > 1 && synced_spread * 2 >= unsynced_spread) {
+        printk("%s: The barrier did not narrow the start spread\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic.h>
+#include <console.h>
+#include <cpu.h>
+#include <errno.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+
+#define NR_STAGES         4
+#define MAX_LANES         64
+#define STAGE_TASK_CYCLES (1000 * 1000)
+
+struct dag_node {
+    unsigned long cycles;
+    int32_t start_seq;
+    int32_t done_seq;
+};
+typedef struct dag_node dag_node_t;
+
+static dag_node_t nodes[NR_STAGES][MAX_LANES];
+static atomic_t seq;
+
+static unsigned long stage_task_func(void *arg) {
+    dag_node_t *node = arg;
+
+    node->start_seq = atomic_inc_return(&seq);
+    wait_cycles(node->cycles);
+    node->done_seq = atomic_inc_return(&seq);
+
+    return 0;
+}
+
+/* Lanes get skewed work, so that the slowest lane differs from stage to stage */
+static task_t *new_stage_task(unsigned int stage, unsigned int lane) {
+    dag_node_t *node = &nodes[stage][lane];
+    task_t *task;
+
+    node->cycles = STAGE_TASK_CYCLES * (1 + (stage + lane) % 4);
+    node->start_seq = node->done_seq = 0;
+
+    task = new_kernel_task("dag", stage_task_func, node);
+    BUG_ON(!task);
+    return task;
+}
+
+static uint64_t run_stages_barrier(cpu_t **lanes, unsigned int nr_lanes) {
+    uint64_t cycles = 0;
+
+    for (unsigned int stage = 0; stage < NR_STAGES; stage++) {
+        uint64_t start;
+
+        for (unsigned int lane = 0; lane < nr_lanes; lane++)
+            schedule_task(new_stage_task(stage, lane), lanes[lane]);
+
+        start = rdtsc();
+        execute_tasks();
+        cycles += rdtsc() - start;
+    }
+
+    return cycles;
+}
+
+/* Each task of a stage consumes the output of two neighbouring lanes */
+static uint64_t run_stages_dag(cpu_t **lanes, unsigned int nr_lanes) {
+    static task_t *tasks[NR_STAGES][MAX_LANES];
+    uint64_t start;
+
+    for (unsigned int stage = 0; stage < NR_STAGES; stage++) {
+        for (unsigned int lane = 0; lane < nr_lanes; lane++) {
+            tasks[stage][lane] = new_stage_task(stage, lane);
+            if (stage == 0)
+                continue;
+
+            BUG_ON(task_depends_on(tasks[stage][lane], tasks[stage - 1][lane]));
+            if (nr_lanes > 1)
+                BUG_ON(task_depends_on(tasks[stage][lane],
+                                       tasks[stage - 1][(lane + 1) % nr_lanes]));
+        }
+    }
+
+    for (unsigned int stage = 0; stage < NR_STAGES; stage++) {
+        for (unsigned int lane = 0; lane < nr_lanes; lane++)
+            schedule_task(tasks[stage][lane], lanes[lane]);
+    }
+
+    start = rdtsc();
+    execute_tasks();
+    return rdtsc() - start;
+}
+
+static unsigned int check_stage_order(unsigned int nr_lanes) {
+    unsigned int violations = 0;
+
+    for (unsigned int stage = 1; stage < NR_STAGES; stage++) {
+        for (unsigned int lane = 0; lane < nr_lanes; lane++) {
+            dag_node_t *node = &nodes[stage][lane];
+
+            if (node->start_seq <= nodes[stage - 1][lane].done_seq ||
+                node->start_seq <= nodes[stage - 1][(lane + 1) % nr_lanes].done_seq)
+                violations++;
+        }
+    }
+
+    return violations;
+}
+
+int test_task_dag(void *unused) {
+    static cpu_t *lanes[MAX_LANES];
+    unsigned int nr_lanes = min(get_nr_cpus(), _u(MAX_LANES));
+    uint64_t barrier_cycles, dag_cycles;
+    unsigned int violations;
+    cpu_t *cpu = NULL;
+
+    for (unsigned int lane = 0; lane < nr_lanes; lane++)
+        lanes[lane] = cpu = get_next_cpu(cpu);
+
+    barrier_cycles = run_stages_barrier(lanes, nr_lanes);
+    dag_cycles = run_stages_dag(lanes, nr_lanes);
+    violations = check_stage_order(nr_lanes);
+
+    printk("%s,cpus,stages,barrier_cycles,dag_cycles,violations\n", __func__);
+    printk("%s,%u,%u,%lu,%lu,%u\n", __func__, nr_lanes, NR_STAGES, barrier_cycles,
+           dag_cycles, violations);
+
+    return violations ? -EINVAL : 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <usermode.h>
+
+#define NR_POOL_TASKS 64
+
+static unsigned long kernel_nop_func(void *unused) {
+    return 0;
+}
+
+static unsigned long __user_text user_nop_func(void *unused) {
+    return 0;
+}
+
+/* Average cycles of a new_task(). The tasks are then run, returning them to the pool.
+ * The number of tasks taken from the pool goes to nr_recycled.
+ */
+static uint64_t spawn_tasks(task_type_t type, unsigned int *nr_recycled) {
+    static task_t *tasks[NR_POOL_TASKS];
+    task_func_t func = type == TASK_TYPE_USER ? user_nop_func : kernel_nop_func;
+    unsigned int nr_pooled = get_nr_pooled_tasks();
+    uint64_t start, cycles;
+
+    start = rdtsc();
+    for (unsigned int i = 0; i < NR_POOL_TASKS; i++)
+        tasks[i] = new_task("pool", func, NULL, type);
+    cycles = rdtsc() - start;
+    *nr_recycled = nr_pooled - get_nr_pooled_tasks();
+
+    for (unsigned int i = 0; i < NR_POOL_TASKS; i++) {
+        BUG_ON(!tasks[i]);
+        schedule_task(tasks[i], get_bsp_cpu());
+    }
+    execute_tasks();
+
+    return cycles / NR_POOL_TASKS;
+}
+
+/* Once a batch ran, the next one has to be allocated from the pool entirely */
+int test_task_pool(void *unused) {
+    uint64_t kernel_first, kernel_recycled, user_first, user_recycled;
+    unsigned int nr_recycled[4];
+
+    kernel_first = spawn_tasks(TASK_TYPE_KERNEL, &nr_recycled[0]);
+    kernel_recycled = spawn_tasks(TASK_TYPE_KERNEL, &nr_recycled[1]);
+    user_first = spawn_tasks(TASK_TYPE_USER, &nr_recycled[2]);
+    user_recycled = spawn_tasks(TASK_TYPE_USER, &nr_recycled[3]);
+
+    printk("%s,type,first_cycles,recycled_cycles,first_pooled,recycled_pooled\n",
+           __func__);
+    printk("%s,kernel,%lu,%lu,%u,%u\n", __func__, kernel_first, kernel_recycled,
+           nr_recycled[0], nr_recycled[1]);
+    printk("%s,user,%lu,%lu,%u,%u\n", __func__, user_first, user_recycled,
+           nr_recycled[2], nr_recycled[3]);
+
+    if (nr_recycled[1] != NR_POOL_TASKS || nr_recycled[3] != NR_POOL_TASKS)
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cmdline.h>
+#include <console.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <time.h>
+#include <timer.h>
+
+#define NOISE_WINDOW_MS 10
+
+static const uint64_t sleep_us[] = {10, 100, 1000, 5000};
+
+/* Sleep accuracy and the number of timer interrupts during a busy window. The
+ * latter is 0 with tickless timers, and one per ms with the periodic tick.
+ */
+int test_timers(void *unused) {
+    unsigned long irqs;
+    uint64_t end;
+    int rc = 0;
+
+    if (!PERCPU_GET(apic_timer_enabled)) {
+        printk("%s: Local APIC timer not enabled, skipping\n", __func__);
+        return 0;
+    }
+
+    printk("%s,tickless,requested_us,slept_ns\n", __func__);
+    for (unsigned int i = 0; i < ARRAY_SIZE(sleep_us); i++) {
+        uint64_t start = ktime_ns(), slept_ns;
+
+        usleep(sleep_us[i]);
+        slept_ns = ktime_ns() - start;
+        printk("%s,%u,%lu,%lu\n", __func__, opt_tickless, sleep_us[i], slept_ns);
+
+        if (slept_ns < sleep_us[i] * 1000) {
+            printk("%s: Woke up early from a %lu us sleep\n", __func__, sleep_us[i]);
+            rc = -1;
+        }
+    }
+
+    irqs = PERCPU_GET(apic_ticks);
+    end = ktime_ns() + NOISE_WINDOW_MS * 1000000;
+    while (ktime_ns() < end)
+        cpu_relax();
+    irqs = PERCPU_GET(apic_ticks) - irqs;
+
+    printk("%s: %lu timer interrupts during %u ms of busy loop\n", __func__, irqs,
+           NOISE_WINDOW_MS);
+
+    return rc;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <percpu.h>
+#include <sched.h>
+#include <trace.h>
+
+#include <smp/smp.h>
+
+#define NR_EVENTS        10000
+#define TEST_TRACE_EVENT 0x7e57
+
+static uint64_t trace_cycles[MAX_CPUS];
+static unsigned long nr_records[MAX_CPUS];
+static bool records_ok;
+
+static unsigned long trace_func(void *unused) {
+    unsigned int cpu = smp_processor_id();
+    uint64_t start = rdtsc();
+
+    for (unsigned int i = 0; i < NR_EVENTS; i++)
+        trace_event(TEST_TRACE_EVENT, i, cpu);
+    if (cpu < MAX_CPUS)
+        trace_cycles[cpu] = rdtsc() - start;
+
+    return 0;
+}
+
+/* Payload words must come back in order, from the CPU that recorded them.
+ * CPUs beyond MAX_CPUS are not accounted.
+ */
+static void check_record(const trace_record_t *rec, void *unused) {
+    if (rec->id != TEST_TRACE_EVENT || rec->cpu >= MAX_CPUS)
+        return;
+
+    if (rec->nr_words != 2 || rec->words[1] != rec->cpu ||
+        rec->words[0] != nr_records[rec->cpu])
+        records_ok = false;
+    nr_records[rec->cpu]++;
+}
+
+/* Every CPU records NR_EVENTS events, which are then walked and checked */
+int test_trace(void *unused) {
+    cpu_t *first = get_next_cpu(NULL), *cpu = first;
+    int rc = 0;
+
+    if (!trace_enabled) {
+        printk("%s: Tracing disabled (trace_size). Skipping.\n", __func__);
+        return 0;
+    }
+
+    trace_reset();
+    memset(trace_cycles, 0, sizeof(trace_cycles));
+    memset(nr_records, 0, sizeof(nr_records));
+    records_ok = true;
+
+    BUG_ON(schedule_on_all_cpus("trace", trace_func, NULL));
+    execute_tasks();
+
+    trace_for_each_record(check_record, NULL);
+
+    printk("%s,cpu,events,dropped,cycles_per_event\n", __func__);
+    do {
+        trace_buf_t *tb = per_cpu_ptr(trace_buf, cpu->percpu);
+
+        if (cpu->id < MAX_CPUS) {
+            printk("%s,%u,%lu,%lu,%lu\n", __func__, cpu->id, nr_records[cpu->id],
+                   tb->dropped, trace_cycles[cpu->id] / NR_EVENTS);
+            if (tb->chunks && nr_records[cpu->id] + tb->dropped != NR_EVENTS)
+                rc = -1;
+        }
+
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first);
+
+    return records_ok ? rc : -1;
+}
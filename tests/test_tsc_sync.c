@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <spinlock.h>
+#include <time.h>
+#include <tsc.h>
+
+#define TSC_WARP_LOOPS 10000
+
+static spinlock_t warp_lock = SPINLOCK_INIT;
+static uint64_t last_tsc, last_ns;
+static unsigned long tsc_warps, ktime_warps;
+
+/* All CPUs take turns reading the time under a lock. Each read has to be later
+ * than the previous one, no matter which CPU did it.
+ */
+static unsigned long warp_func(void *unused) {
+    for (unsigned int i = 0; i < TSC_WARP_LOOPS; i++) {
+        spin_lock(&warp_lock);
+
+        uint64_t tsc = rdtscp();
+        uint64_t ns = ktime_ns();
+
+        if (tsc < last_tsc)
+            tsc_warps++;
+        if (ns < last_ns)
+            ktime_warps++;
+        last_tsc = tsc;
+        last_ns = ns;
+
+        spin_unlock(&warp_lock);
+    }
+
+    return 0;
+}
+
+int test_tsc_sync(void *unused) {
+    BUG_ON(schedule_on_all_cpus("tsc_warp", warp_func, NULL));
+    execute_tasks();
+
+    printk("%s,tsc_khz,synchronized,tsc_warps,ktime_warps\n", __func__);
+    printk("%s,%lu,%u,%lu,%lu\n", __func__, get_tsc_khz(), is_tsc_synchronized(),
+           tsc_warps, ktime_warps);
+
+    return 0;
+}
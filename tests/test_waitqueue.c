@@ -0,0 +1,124 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <console.h>
+#include <cpu.h>
+#include <errno.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <timer.h>
+
+#define NR_WAITERS 16
+#define TIMEOUT_US 2000
+
+static sem_t sem;
+static sem_t empty_sem;
+static volatile uint64_t post_tsc;
+static uint64_t wake_cycles[NR_WAITERS];
+static volatile unsigned int nr_woken;
+static uint64_t timeout_cycles;
+static int timeout_rc;
+
+static unsigned long waiter_func(void *unused) {
+    sem_wait(&sem);
+    wake_cycles[nr_woken++] = rdtsc() - post_tsc;
+
+    return 0;
+}
+
+/* Give the waiters the chance to block first */
+static unsigned long poster_func(void *unused) {
+    for (unsigned int i = 0; i < NR_WAITERS; i++)
+        task_yield();
+
+    for (unsigned int i = 0; i < NR_WAITERS; i++) {
+        post_tsc = rdtsc();
+        sem_post(&sem);
+        task_yield();
+    }
+
+    return 0;
+}
+
+static unsigned long timeout_func(void *unused) {
+    uint64_t start = rdtsc();
+
+    timeout_rc = sem_wait_units_timeout(&empty_sem, 1, TIMEOUT_US);
+    timeout_cycles = rdtsc() - start;
+
+    return 0;
+}
+
+/* Coroutines blocked on a semaphore are parked until sem_post(). A wait on a
+ * semaphore that is never posted has to time out.
+ */
+int test_waitqueue(void *unused) {
+    cpu_t *cpu = get_bsp_cpu();
+    uint64_t min_cycles = ULONG_MAX, max_cycles = 0, total = 0;
+    task_t *task;
+
+    sem_init(&sem, 0);
+    sem_init(&empty_sem, 0);
+    nr_woken = 0;
+
+    for (unsigned int i = 0; i < NR_WAITERS; i++) {
+        task = new_coroutine_task("sem_waiter", waiter_func, NULL);
+        BUG_ON(!task);
+        schedule_task(task, cpu);
+    }
+
+    task = new_coroutine_task("sem_poster", poster_func, NULL);
+    BUG_ON(!task);
+    schedule_task(task, cpu);
+
+    task = new_coroutine_task("sem_timeout", timeout_func, NULL);
+    BUG_ON(!task);
+    schedule_task(task, cpu);
+
+    execute_tasks();
+
+    for (unsigned int i = 0; i < nr_woken; i++) {
+        min_cycles = min(min_cycles, wake_cycles[i]);
+        max_cycles = max(max_cycles, wake_cycles[i]);
+        total += wake_cycles[i];
+    }
+
+    printk("%s,waiters,woken,wake_cycles_min,wake_cycles_avg,wake_cycles_max\n",
+           __func__);
+    printk("%s,%u,%u,%lu,%lu,%lu\n", __func__, NR_WAITERS, nr_woken,
+           nr_woken ? min_cycles : 0, nr_woken ? total / nr_woken : 0, max_cycles);
+
+    printk("%s,timeout_us,rc,elapsed_cycles,expected_cycles\n", __func__);
+    printk("%s,%u,%d,%lu,%lu\n", __func__, TIMEOUT_US, timeout_rc, timeout_cycles,
+           us_to_tsc(TIMEOUT_US));
+
+    /* An early timeout is as wrong as none */
+    if (nr_woken != NR_WAITERS || timeout_rc != -ETIMEDOUT ||
+        timeout_cycles < us_to_tsc(TIMEOUT_US))
+        return -1;
+
+    return 0;
+}
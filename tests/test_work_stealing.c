@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2023 Open Source Security, Inc.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cmdline.h>
+#include <console.h>
+#include <cpu.h>
+#include <ktf.h>
+#include <lib.h>
+#include <sched.h>
+
+#define TASKS_PER_CPU 8
+#define MAX_TASKS     256
+
+#define LIGHT_TASK_CYCLES (1000 * 1000)
+#define HEAVY_TASK_CYCLES (20 * LIGHT_TASK_CYCLES)
+
+static unsigned long busy_task_func(void *arg) {
+    wait_cycles(_ul(arg));
+    return 0;
+}
+
+static unsigned int nr_stolen_tasks(void) {
+    cpu_t *first_cpu = get_next_cpu(NULL), *cpu = first_cpu;
+    unsigned int nr_stolen = 0;
+
+    do {
+        nr_stolen += cpu->nr_stolen;
+        cpu = get_next_cpu(cpu);
+    } while (cpu && cpu != first_cpu);
+
+    return nr_stolen;
+}
+
+/* Round-robin placement puts every heavy task on the same CPU */
+static uint64_t run_skewed_tasks(bool steal) {
+    unsigned int nr_cpus = get_nr_cpus();
+    unsigned int nr_tasks = min(nr_cpus * TASKS_PER_CPU, _u(MAX_TASKS));
+    uint64_t start;
+
+    opt_sched_steal = steal;
+
+    for (unsigned int i = 0; i < nr_tasks; i++) {
+        unsigned long cycles = (i % nr_cpus) ? LIGHT_TASK_CYCLES : HEAVY_TASK_CYCLES;
+        task_t *task = new_kernel_task("skewed", busy_task_func, _ptr(cycles));
+
+        BUG_ON(!task);
+        schedule_task_balanced(task);
+    }
+
+    start = rdtsc();
+    execute_tasks();
+    return rdtsc() - start;
+}
+
+int test_work_stealing(void *unused) {
+    bool saved_opt = opt_sched_steal;
+    uint64_t static_cycles, steal_cycles;
+    unsigned int nr_stolen;
+
+    static_cycles = run_skewed_tasks(false);
+    steal_cycles = run_skewed_tasks(true);
+    nr_stolen = nr_stolen_tasks();
+
+    opt_sched_steal = saved_opt;
+
+    printk("%s,cpus,static_cycles,steal_cycles,stolen\n", __func__);
+    printk("%s,%u,%lu,%lu,%u\n", __func__, get_nr_cpus(), static_cycles, steal_cycles,
+           nr_stolen);
+
+    if (get_nr_cpus() < 2)
+        return 0;
+
+    if (nr_stolen == 0) {
+        printk("%s: No task got stolen\n", __func__);
+        return -1;
+    }
+
+    if (steal_cycles >= static_cycles) {
+        printk("%s: Stealing did not shorten the makespan\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
@@ -198,6 +198,12 @@ int unit_tests(void *_unused) {
     unmap_pagetables(&cr3, NULL);
     unmap_pagetables(&cr3, &user_cr3);
 
+    printk("PAT cache flags: WB: 0x%lx WT: 0x%lx WC: 0x%lx UC: 0x%lx\n",
+           pat_cache_flags(WB), pat_cache_flags(WT), pat_cache_flags(WC),
+           pat_cache_flags(UC));
+    BUG_ON(pat_cache_flags(WB) != PT_NO_FLAGS);
+    BUG_ON(pat_cache_flags(UC) != (_PAGE_PWT | _PAGE_PCD));
+
     map_pagetables_va(&cr3, unit_tests);
     pte_t *pte2 = get_pte(unit_tests);
     printk("PTE: 0x%lx\n", pte2->entry);
@@ -0,0 +1,158 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+"""
+ Copyright © 2023 Open Source Security, Inc.
+ All Rights Reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ 1. Redistributions of source code must retain the above copyright notice, this
+    list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+"""
+
+import argparse
+import binascii
+import struct
+import sys
+
+
+TRACE_MAGIC = b"KTFTRACE"
+TRACE_VERSION = 1
+HEX_PREFIX = "ktftrace:"
+
+# Layouts of include/trace.h
+trace_header = struct.Struct("<8sIIQ")
+trace_cpu_header = struct.Struct("<IIQQ")
+trace_record = struct.Struct("<QHHB3x")
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Decode a KTF binary trace dump into CSV')
+    parser.add_argument(
+        'input',
+        nargs='?',
+        default='-',
+        type=str,
+        help='Binary dump (trace_port) or console log (ktftrace: lines)'
+    )
+    parser.add_argument(
+        '-o', '--output',
+        dest='output_file',
+        default='-',
+        type=str,
+        help='Name of the output CSV file'
+    )
+    parser.add_argument(
+        '-e', '--event',
+        dest='events',
+        action='append',
+        default=[],
+        type=str,
+        help='Event name, as NAME=ID (may be repeated)'
+    )
+
+    return parser.parse_args()
+
+
+def read_input(name):
+    if name == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        with open(name, 'rb') as f:
+            data = f.read()
+
+    if data.startswith(TRACE_MAGIC):
+        return data
+
+    # Console log: the dump is hex encoded after the prefix, anywhere in a line
+    dump = bytearray()
+    for line in data.decode('ascii', errors='replace').splitlines():
+        pos = line.find(HEX_PREFIX)
+        if pos >= 0:
+            dump += binascii.unhexlify(line[pos + len(HEX_PREFIX):].strip())
+
+    return bytes(dump)
+
+
+def parse_events(specs):
+    events = {}
+
+    for spec in specs:
+        name, _, event_id = spec.partition('=')
+        events[int(event_id, 0)] = name
+
+    return events
+
+
+def decode(dump):
+    magic, version, nr_cpus, tsc_khz = trace_header.unpack_from(dump, 0)
+    if magic != TRACE_MAGIC:
+        sys.exit("Not a KTF trace dump")
+    if version != TRACE_VERSION:
+        sys.exit("Unsupported trace version %u" % version)
+
+    records = []
+    offset = trace_header.size
+    for _ in range(nr_cpus):
+        cpu, _, size, dropped = trace_cpu_header.unpack_from(dump, offset)
+        offset += trace_cpu_header.size
+        if dropped:
+            sys.stderr.write("CPU[%u]: %u events dropped\n" % (cpu, dropped))
+
+        end = offset + size
+        while offset < end:
+            tsc, event_id, rec_cpu, nr_words = trace_record.unpack_from(dump, offset)
+            offset += trace_record.size
+            words = struct.unpack_from("<%uQ" % nr_words, dump, offset)
+            offset += 8 * nr_words
+            records.append((tsc, rec_cpu, event_id, words))
+
+    records.sort(key=lambda rec: rec[0])
+    return tsc_khz, records
+
+
+def write_csv(output, tsc_khz, records, events):
+    max_words = max([len(rec[3]) for rec in records] or [0])
+    start = records[0][0] if records else 0
+
+    columns = ["tsc", "ns", "cpu", "event"]
+    columns += ["w%u" % i for i in range(max_words)]
+    output.write(",".join(columns) + "\n")
+
+    for tsc, cpu, event_id, words in records:
+        ns = (tsc - start) * 1000000 // tsc_khz if tsc_khz else 0
+        event = events.get(event_id, "0x%x" % event_id)
+        row = [str(tsc), str(ns), str(cpu), event] + [str(w) for w in words]
+        output.write(",".join(row) + "\n")
+
+
+def main():
+    args = parse_args()
+    tsc_khz, records = decode(read_input(args.input))
+    events = parse_events(args.events)
+
+    if args.output_file == '-':
+        write_csv(sys.stdout, tsc_khz, records, events)
+    else:
+        with open(args.output_file, 'w') as output:
+            write_csv(output, tsc_khz, records, events)
+
+
+if __name__ == "__main__":
+    main()